@@ -0,0 +1,18 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* Positions searched by bench, also used as corpus of microbench. */
+extern const char *bench_fens[];
+extern const int   bench_nfens;
+
+/* Searches fixed set of positions to given depth with hash of size MB and
+   given number of threads, prints total number of nodes and speed. */
+void bench(int depth, int hash, int threads);
+
+/* Checks syzygy tables found in path on given number of random positions
+   of each material, prints positions which disagree with own endgame tables
+   of dir or whose result is not the best one of their moves. */
+void tb_check(const char *path, const char *dir, int positions);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,17 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __BOOK_H__
+#define __BOOK_H__
+
+#include "chesslib.h"
+#include "position.h"
+
+/* Maps polyglot book file, unmaps previous one. Returns number of entries,
+   0 if file cannot be used. */
+int book_init(const char *file);
+void book_free(void);
+/* Returns legal book move of pos, MOVE_NONE if there is none. With best set
+   move of highest weight is chosen, otherwise a random one in proportion to
+   weights. */
+Move book_probe(Position *pos, int best);
+
+#endif /* __BOOK_H__ */
@@ -8,6 +8,7 @@
 #define MAX_PLY      64
 #define INFINITY     50000
 #define MATE_VALUE   49000
+#define VALUE_NONE   (INFINITY + 1)
 
 typedef uint64_t U64;
 
@@ -111,6 +112,13 @@ promotion_type(Move m)
   return (PieceType)(((m >> 14) & 3) + KNIGHT);
 }
 
+/* Returns move with its score removed. */
+inline Move
+move_of(Move m)
+{
+  return (Move)(m & 0xFFFF);
+}
+
 inline Move
 make_move(Square from, Square to)
 {
@@ -0,0 +1,173 @@
+/* See LICENSE file for file for copyright and license details */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitboards.h"
+#include "chesslib.h"
+#include "datagen.h"
+#include "misc.h"
+#include "movegen.h"
+#include "moveorder.h"
+#include "nnue.h"
+#include "position.h"
+#include "search.h"
+#include "timeman.h"
+
+#define STARTPOS     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define RANDOM_PLIES 8    /* random moves at the start of each game */
+#define MAX_GAME     400  /* plies after which game is adjudicated as draw */
+#define ADJUDICATE   2000 /* score after which game is adjudicated as win */
+
+static uint64_t state;
+
+static uint64_t
+next_rand(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+/* Returns number of legal moves, fills move_list with them. */
+static int
+legal_moves(Position *pos, Move *move_list)
+{
+  Move *last = generate_moves(ALL, move_list, pos);
+  return process_moves(pos, move_list, last, MOVE_NONE) - move_list;
+}
+
+static int
+is_draw(Position *pos)
+{
+  int n = 1;
+  if (pos->st->fifty_move_rule >= 100)
+    return 1;
+  for (int i = pos->game_ply - 1; i >= pos->game_ply - pos->st->fifty_move_rule; i--)
+    n += pos->reps[i] == pos->key;
+  return n >= 3;
+}
+
+void
+pack_position(const Position *pos, int score, PackedPos *pp)
+{
+  U64 mask = ~pos->empty;
+  Square sq;
+  int c;
+
+  memset(pp, 0, sizeof(*pp));
+  pp->occupancy = mask;
+  for (int i = 0; mask; i++) {
+    sq = pop_lsb(&mask);
+    c = (pos->color[BLACK] >> sq) & 1;
+    pp->pieces[i / 2] |= (c << 3 | pos->board[sq]) << 4 * (i & 1);
+  }
+  pp->score = score < -32000 ? -32000 : score > 32000 ? 32000 : score;
+  pp->turn  = pos->turn;
+}
+
+int
+unpack_features(const PackedPos *pp, int *white, int *black)
+{
+  U64 mask = pp->occupancy;
+  Square sq;
+  int i, p;
+
+  for (i = 0; mask; i++) {
+    sq = pop_lsb(&mask);
+    p = (pp->pieces[i / 2] >> 4 * (i & 1)) & 15;
+    white[i] = nnue_feature(p & 7, p >> 3, sq, WHITE);
+    black[i] = nnue_feature(p & 7, p >> 3, sq, BLACK);
+  }
+  return i;
+}
+
+void
+datagen(const char *file, int games, int depth, uint64_t seed)
+{
+  Position pos = (Position){ .tt = NULL, .st = NULL };
+  PackedPos buf[MAX_GAME];
+  Move move_list[256], move;
+  int n, nmoves, result, score;
+  uint64_t total = 0;
+  FILE *f;
+
+  if (!(f = fopen(file, "ab"))) {
+    printf("cannot open %s\n", file);
+    return;
+  }
+
+#ifdef NNUE
+  if (nnue_load(NNUE_FILE))
+    printf("info string cannot load network %s, using classical evaluation\n",
+           NNUE_FILE);
+#endif
+
+  state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+  info.silent      = 1;
+  info.threads     = 1;
+  info.multipv     = 1;
+  info.mate        = 0;
+  info.nodes_limit = 0;
+
+  for (int g = 0; g < games; g++) {
+    set_position(&pos, STARTPOS);
+    search_clear(&pos);
+    n = 0;
+    result = 1;
+
+    /* openings are random, so that games differ */
+    for (int i = 0; i < RANDOM_PLIES; i++) {
+      if (!(nmoves = legal_moves(&pos, move_list)))
+        break;
+      do_move(&pos, move_of(move_list[next_rand() % nmoves]));
+    }
+
+    while (pos.game_ply < RANDOM_PLIES + MAX_GAME && !is_draw(&pos)) {
+      if (!legal_moves(&pos, move_list)) {
+        if (in_check(&pos))
+          result = pos.turn == WHITE ? 0 : 2;
+        break;
+      }
+
+      info.depth     = depth;
+      info.starttime = get_time();
+      info.stopped   = 0;
+      time_init(-1, 0, 0, -1);
+      search(&pos);
+      move  = info.best_move;
+      score = pos.turn == WHITE ? info.best_value : -info.best_value;
+
+      if (abs(score) >= ADJUDICATE) {
+        result = score > 0 ? 2 : 0;
+        break;
+      }
+
+      /* evaluation should learn quiet positions, search resolves the rest */
+      if (!in_check(&pos) && type_of(move) == NORMAL
+      &&  pos.board[to_sq(move)] == NONE)
+        pack_position(&pos, score, buf + n++);
+
+      do_move(&pos, move);
+    }
+
+    for (int i = 0; i < n; i++)
+      buf[i].result = result;
+    fwrite(buf, sizeof(PackedPos), n, f);
+    total += n;
+
+    if ((g + 1) % 10 == 0 || g + 1 == games) {
+      printf("games %d positions %lu\n", g + 1, total);
+      fflush(stdout);
+    }
+  }
+
+  fclose(f);
+  info.silent = 0;
+  delete_threads();
+  tt_delete(pos.tt);
+#ifdef NNUE
+  nnue_unload();
+#endif
+}
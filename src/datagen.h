@@ -0,0 +1,30 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __DATAGEN_H__
+#define __DATAGEN_H__
+
+#include <inttypes.h>
+
+#include "chesslib.h"
+#include "position.h"
+
+/* Training position, 32 bytes. */
+typedef struct {
+  uint64_t occupancy;
+  uint8_t  pieces[16]; /* 4 bits per piece in order of occupancy bits,
+                          color << 3 | PieceType */
+  int16_t  score;      /* search score for white */
+  uint8_t  result;     /* result of game for white, 0 loss, 1 draw, 2 win */
+  uint8_t  turn;
+  uint32_t unused;
+} PackedPos;
+
+/* Plays games of engine against itself with search to given depth, appends
+   quiet positions with their scores and results of games to file. */
+void datagen(const char *file, int games, int depth, uint64_t seed);
+
+void pack_position(const Position *pos, int score, PackedPos *pp);
+/* Fills features of position for white and black perspective, returns
+   number of pieces. */
+int unpack_features(const PackedPos *pp, int *white, int *black);
+
+#endif /* __DATAGEN_H__ */
@@ -0,0 +1,808 @@
+/* See LICENSE file for file for copyright and license details */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitboards.h"
+#include "chesslib.h"
+#include "egtb.h"
+#include "misc.h"
+#include "position.h"
+
+/*
+ * Distance to mate tables of positions with few pieces, found by retrograde
+ * analysis. Value of a position is number of plies to mate + 1, even if side
+ * to move mates, odd if it is mated, 0 for draws. Castling and en passant are
+ * not considered.
+ *
+ * Positions are indexed by the pair of kings, then by squares of the other
+ * pieces in order of material, with identical pieces indexed as a set. The
+ * board is mirrored and, without pawns, flipped and transposed so that the
+ * kings are one of 462 pairs, or one of 1806 pairs with white king on files
+ * a-d if there are pawns. A position symmetric to itself may then be reached
+ * at two indices, the larger of which is unused. Moves from a position are
+ * counted once per index they lead to, so retrograde analysis stays exact.
+ *
+ * Files store values in blocks of BLOCK positions, each a palette of values
+ * found in it followed by index of every value in the palette, packed in as
+ * few bits as the palette needs. Impossible positions take any value.
+ */
+
+#define MAGIC       0x32544745 /* "EGT2" */
+#define MAX_TABLES  64
+#define GEN_THREADS 64
+#define BLOCK       1024 /* positions of a block of a file */
+#define ILLEGAL     255  /* value of impossible positions */
+#define NO_CONV     255  /* position has no capture or promotion */
+#define NO_INDEX    UINT64_MAX
+
+typedef struct {
+  int       n;                 /* pieces */
+  PieceType type[EGTB_PIECES]; /* kings, white pieces, black pieces */
+  Color     color[EGTB_PIECES];
+  int       code[2];           /* material of each color, see material_code */
+  int       pawns;
+  int       groups;            /* sets of identical pieces, kings aside */
+  int       first[EGTB_PIECES]; /* first piece of each set */
+  int       len[EGTB_PIECES];   /* pieces of each set */
+  uint64_t  combs[EGTB_PIECES]; /* placements of each set */
+  uint64_t  size;              /* positions of one side to move */
+  char      name[16];
+  uint8_t  *data;              /* values while generated, white to move first */
+  void     *map;               /* mapped file */
+  size_t    map_size;
+  const uint32_t *offset;      /* of each block in blocks */
+  const uint8_t  *blocks;
+} Table;
+
+typedef struct {
+  int       n;
+  PieceType type[EGTB_PIECES];
+  Color     color[EGTB_PIECES];
+  Square    sq[EGTB_PIECES];
+  Color     turn;
+} Board;
+
+/* Part of a table generated by one thread. */
+typedef struct {
+  Table    *t;
+  uint8_t  *cnt;  /* moves not resolved yet, captures and promotions aside */
+  uint8_t  *conv; /* best value reached by capture or promotion */
+  uint64_t  from;
+  uint64_t  to;
+  int       value; /* value being resolved */
+  uint64_t  found; /* positions of value, max value of conv for init */
+  int       missing; /* a capture or promotion leads to a table not loaded */
+} Work;
+
+int egtb_largest;
+
+static Table    tables[MAX_TABLES];
+static int      ntables;
+static int      kk_index[2][64][64]; /* of king pairs without and with pawns */
+static Square   kk_square[2][1806][2];
+static int      kk_count[2];
+static uint64_t binomial[65][EGTB_PIECES];
+
+static int
+material_code(const PieceType *types, int n)
+{
+  int code = n;
+  for (int i = 0; i < n; i++)
+    code = code * 8 + types[i] + 1;
+  return code;
+}
+
+static void
+add_table(const PieceType *w, int nw, const PieceType *b, int nb)
+{
+  Table *t = tables + ntables++;
+  char *s = t->name;
+
+  t->n = 2;
+  t->type[0]  = t->type[1] = KING;
+  t->color[0] = WHITE;
+  t->color[1] = BLACK;
+  *s++ = 'K';
+  for (int i = 0; i < nw; i++) {
+    t->type[t->n]    = w[i];
+    t->color[t->n++] = WHITE;
+    *s++ = piece_to_char(w[i]);
+  }
+  *s++ = 'v';
+  *s++ = 'K';
+  for (int i = 0; i < nb; i++) {
+    t->type[t->n]    = b[i];
+    t->color[t->n++] = BLACK;
+    *s++ = piece_to_char(b[i]);
+  }
+  *s = '\0';
+
+  t->code[WHITE] = material_code(w, nw);
+  t->code[BLACK] = material_code(b, nb);
+  for (int i = 0; i < t->n; i++)
+    t->pawns += t->type[i] == PAWN;
+  t->size = kk_count[!!t->pawns];
+  for (int i = 2; i < t->n; i++) {
+    if (t->type[i] != t->type[i - 1] || t->color[i] != t->color[i - 1]
+    ||  i == 2) {
+      t->first[t->groups] = i;
+      t->len[t->groups++] = 0;
+    }
+    t->len[t->groups - 1]++;
+  }
+  for (int g = 0; g < t->groups; g++) {
+    t->combs[g] = binomial[t->type[t->first[g]] == PAWN ? 48 : 64][t->len[g]];
+    t->size    *= t->combs[g];
+  }
+}
+
+/* Returns sq mirrored by bit 0 of m, flipped by bit 1 and transposed along
+   a1-h8 by bit 2. */
+static inline Square
+transform(Square sq, int m)
+{
+  if (m & 4)
+    sq = (7 - (sq & 7)) * 8 + 7 - (sq >> 3);
+  return sq ^ (m & 1 ? 7 : 0) ^ (m & 2 ? 56 : 0);
+}
+
+/* Numbers pairs of kings which are apart, white king in a1-d1-d4 and black
+   king not above a1-h8 if white king is on it, or white king on files a-d
+   if there are pawns. */
+static void
+init_kings(void)
+{
+  for (int p = 0; p < 2; p++)
+    for (Square wk = 0; wk < 64; wk++)
+      for (Square bk = 0; bk < 64; bk++) {
+        int wf = wk & 7, wr = 7 - (wk >> 3), bf = bk & 7, br = 7 - (bk >> 3);
+        kk_index[p][wk][bk] = -1;
+        if (abs(wf - bf) <= 1 && abs(wr - br) <= 1)
+          continue;
+        if (p ? wf > 3 : wf > 3 || wr > wf || (wr == wf && br > bf))
+          continue;
+        kk_square[p][kk_count[p]][0] = wk;
+        kk_square[p][kk_count[p]][1] = bk;
+        kk_index[p][wk][bk] = kk_count[p]++;
+      }
+
+  for (int n = 0; n <= 64; n++)
+    for (int k = 0; k < EGTB_PIECES; k++)
+      binomial[n][k] = !k ? 1 : !n ? 0 : binomial[n - 1][k - 1] + binomial[n - 1][k];
+}
+
+/* Lists materials stronger for white, ordered so that tables reached by
+   captures and promotions come first. */
+static void
+init_materials(void)
+{
+  PieceType sets[21][2];
+  int lens[21], n = 0;
+  Table tmp;
+
+  if (ntables)
+    return;
+  init_kings();
+  lens[n++] = 0;
+  for (int a = QUEEN; a >= PAWN; a--) {
+    sets[n][0] = a;
+    lens[n++]  = 1;
+    for (int b = a; b >= PAWN; b--) {
+      sets[n][0] = a;
+      sets[n][1] = b;
+      lens[n++]  = 2;
+    }
+  }
+
+  for (int w = 0; w < n; w++)
+    for (int b = 0; b < n; b++)
+      if (2 + lens[w] + lens[b] >= 3 && 2 + lens[w] + lens[b] <= EGTB_PIECES
+      &&  material_code(sets[w], lens[w]) >= material_code(sets[b], lens[b]))
+        add_table(sets[w], lens[w], sets[b], lens[b]);
+
+  for (int i = 1; i < ntables; i++)
+    for (int j = i; j > 0 && tables[j].n * 8 + tables[j].pawns
+                           < tables[j - 1].n * 8 + tables[j - 1].pawns; j--)
+      tmp = tables[j], tables[j] = tables[j - 1], tables[j - 1] = tmp;
+}
+
+/* Returns index of squares of set g among placements of the set. */
+static uint64_t
+set_index(const Table *t, int g, const Square *sq)
+{
+  int base = t->type[t->first[g]] == PAWN ? 8 : 0, s[EGTB_PIECES], tmp;
+  uint64_t idx = 0;
+
+  for (int i = 0; i < t->len[g]; i++) {
+    s[i] = sq[t->first[g] + i] - base;
+    for (int j = i; j > 0 && s[j] < s[j - 1]; j--)
+      tmp = s[j], s[j] = s[j - 1], s[j - 1] = tmp;
+  }
+  for (int i = 0; i < t->len[g]; i++)
+    idx += binomial[s[i]][i + 1];
+  return idx;
+}
+
+/* Returns the smallest index of the position among its symmetries, NO_INDEX
+   if kings touch. */
+static uint64_t
+index_of(const Table *t, const Square *sq, Color turn)
+{
+  uint64_t best = NO_INDEX, idx;
+  Square s[EGTB_PIECES];
+  int kk;
+
+  for (int m = 0; m < (t->pawns ? 2 : 8); m++) {
+    if ((kk = kk_index[!!t->pawns][transform(sq[0], m)][transform(sq[1], m)]) < 0)
+      continue;
+    for (int i = 2; i < t->n; i++)
+      s[i] = transform(sq[i], m);
+    idx = kk;
+    for (int g = 0; g < t->groups; g++)
+      idx = idx * t->combs[g] + set_index(t, g, s);
+    best = idx < best ? idx : best;
+  }
+  return best == NO_INDEX ? NO_INDEX : turn * t->size + best;
+}
+
+static void
+decode(const Table *t, uint64_t idx, Board *b)
+{
+  uint64_t r;
+  int kk, base, s;
+
+  b->n    = t->n;
+  b->turn = idx >= t->size;
+  idx    -= b->turn * t->size;
+  for (int i = 0; i < t->n; i++) {
+    b->type[i]  = t->type[i];
+    b->color[i] = t->color[i];
+  }
+  for (int g = t->groups - 1; g >= 0; g--) {
+    r    = idx % t->combs[g];
+    idx /= t->combs[g];
+    base = t->type[t->first[g]] == PAWN ? 8 : 0;
+    s    = base ? 48 : 64;
+    for (int i = t->len[g] - 1; i >= 0; i--) {
+      while (binomial[s][i + 1] > r)
+        s--;
+      r -= binomial[s][i + 1];
+      b->sq[t->first[g] + i] = s + base;
+    }
+  }
+  kk       = idx;
+  b->sq[0] = kk_square[!!t->pawns][kk][0];
+  b->sq[1] = kk_square[!!t->pawns][kk][1];
+}
+
+static U64
+pieces_of(const Board *b, Color c)
+{
+  U64 mask = 0;
+  for (int i = 0; i < b->n; i++)
+    if (b->color[i] == c)
+      mask |= get_bitboard(b->sq[i]);
+  return mask;
+}
+
+/* Returns 1 if king of color c is attacked. */
+static int
+in_check_b(const Board *b, Color c)
+{
+  U64 occ = pieces_of(b, WHITE) | pieces_of(b, BLACK), king = 0, att = 0;
+
+  for (int i = 0; i < b->n; i++)
+    if (b->color[i] == c && b->type[i] == KING)
+      king = get_bitboard(b->sq[i]);
+    else if (b->color[i] != c)
+      att |= b->type[i] == PAWN ? pawn_attacks_bb(b->color[i], b->sq[i])
+                                : attacks_bb(b->type[i], b->sq[i], occ);
+  return !!(att & king);
+}
+
+/* Returns squares piece i can move to, en passant aside. */
+static U64
+targets(const Board *b, int i)
+{
+  U64 own = pieces_of(b, b->color[i]), occ = own | pieces_of(b, !b->color[i]);
+  Square sq = b->sq[i];
+  int up = b->color[i] == WHITE ? NORTH : SOUTH;
+  U64 t;
+
+  if (b->type[i] != PAWN)
+    return attacks_bb(b->type[i], sq, occ) & ~own;
+  t = pawn_attacks_bb(b->color[i], sq) & occ & ~own;
+  if (!(occ & get_bitboard(sq + up))) {
+    t |= get_bitboard(sq + up);
+    if ((sq >> 3) == (b->color[i] == WHITE ? 6 : 1)
+    &&  !(occ & get_bitboard(sq + 2 * up)))
+      t |= get_bitboard(sq + 2 * up);
+  }
+  return t;
+}
+
+/* Returns squares piece i could come from by a move which is not a capture
+   or promotion. */
+static U64
+sources(const Board *b, int i)
+{
+  U64 occ = pieces_of(b, WHITE) | pieces_of(b, BLACK);
+  Square sq = b->sq[i];
+  int down = b->color[i] == WHITE ? SOUTH : NORTH;
+  U64 s;
+
+  if (b->type[i] != PAWN)
+    return attacks_bb(b->type[i], sq, occ) & ~occ;
+  if (((sq + down) >> 3) < 1 || ((sq + down) >> 3) > 6
+  ||  (occ & get_bitboard(sq + down)))
+    return 0;
+  s = get_bitboard(sq + down);
+  if ((sq >> 3) == (b->color[i] == WHITE ? 4 : 3)
+  &&  !(occ & get_bitboard(sq + 2 * down)))
+    s |= get_bitboard(sq + 2 * down);
+  return s;
+}
+
+/* Moves piece i to sq, as pt if it promotes. Returns 1 if it captures. */
+static int
+play(Board *b, int i, Square sq, PieceType pt)
+{
+  b->sq[i]   = sq;
+  b->type[i] = pt;
+  b->turn    = !b->turn;
+  for (int j = 0; j < b->n; j++)
+    if (j != i && b->sq[j] == sq) {
+      b->n--;
+      b->type[j]  = b->type[b->n];
+      b->color[j] = b->color[b->n];
+      b->sq[j]    = b->sq[b->n];
+      return 1;
+    }
+  return 0;
+}
+
+static const Table *
+find_table(const Board *b, int *flip)
+{
+  PieceType types[2][EGTB_PIECES], tmp;
+  int n[2] = { 0, 0 }, code[2];
+
+  for (int i = 0; i < b->n; i++)
+    if (b->type[i] != KING)
+      types[b->color[i]][n[b->color[i]]++] = b->type[i];
+  for (Color c = WHITE; c <= BLACK; c++) {
+    for (int i = 1; i < n[c]; i++)
+      for (int j = i; j > 0 && types[c][j] > types[c][j - 1]; j--)
+        tmp = types[c][j], types[c][j] = types[c][j - 1], types[c][j - 1] = tmp;
+    code[c] = material_code(types[c], n[c]);
+  }
+
+  *flip = code[BLACK] > code[WHITE];
+  for (int i = 0; i < ntables; i++)
+    if (tables[i].map && tables[i].code[WHITE] == code[*flip]
+    &&  tables[i].code[BLACK] == code[!*flip])
+      return tables + i;
+  return NULL;
+}
+
+/* Returns value of position idx of a loaded table. */
+static int
+value_at(const Table *t, uint64_t idx)
+{
+  const uint8_t *block = t->blocks + t->offset[idx / BLOCK], *codes;
+  int colors = block[0], bits = 0, i = idx % BLOCK;
+  unsigned bit, word;
+
+  while ((1 << bits) < colors)
+    bits++;
+  if (!bits)
+    return block[1];
+  codes = block + 1 + colors;
+  bit   = i * bits;
+  word  = codes[bit >> 3] | codes[(bit >> 3) + 1] << 8;
+  return block[1 + ((word >> (bit & 7)) & ((1 << bits) - 1))];
+}
+
+/* Returns value of b, -1 if its table is not loaded. */
+static int
+lookup(const Board *b)
+{
+  Square sq[EGTB_PIECES];
+  const Table *t;
+  int used = 0, flip;
+
+  if (b->n == 2)
+    return 0;
+  if (!(t = find_table(b, &flip)))
+    return -1;
+  /* colors are swapped if black is stronger */
+  for (int j = 0; j < t->n; j++)
+    for (int i = 0; i < b->n; i++)
+      if (!(used >> i & 1) && b->type[i] == t->type[j]
+      &&  (b->color[i] ^ flip) == t->color[j]) {
+        used |= 1 << i;
+        sq[j] = b->sq[i] ^ (flip ? 56 : 0);
+        break;
+      }
+  return value_at(t, index_of(t, sq, b->turn ^ flip));
+}
+
+/* Orders values by preference of side to move. */
+static inline int
+rank_of(int v)
+{
+  return !v ? 0 : v & 1 ? v - 1000 : 1000 - v;
+}
+
+static void
+init_position(Work *w, uint64_t k)
+{
+  Board b, c;
+  int moves = 0, pt, last, best = NO_CONV, v, n = 0, j;
+  uint64_t next[256], q;
+  U64 to;
+
+  decode(w->t, k, &b);
+  if (popcount(pieces_of(&b, WHITE) | pieces_of(&b, BLACK)) != b.n
+  ||  in_check_b(&b, !b.turn) || index_of(w->t, b.sq, b.turn) != k) {
+    w->t->data[k] = ILLEGAL;
+    return;
+  }
+
+  w->t->data[k] = 0;
+  w->cnt[k] = 0;
+  for (int i = 0; i < b.n; i++) {
+    if (b.color[i] != b.turn)
+      continue;
+    to = targets(&b, i);
+    while (to) {
+      Square sq = pop_lsb(&to);
+      int promotion = b.type[i] == PAWN && ((sq >> 3) == 0 || (sq >> 3) == 7);
+      pt   = promotion ? QUEEN : b.type[i];
+      last = promotion ? KNIGHT : b.type[i];
+      for (; pt >= last; pt--) {
+        c = b;
+        if (play(&c, i, sq, pt) || promotion) {
+          if (in_check_b(&c, b.turn))
+            break;
+          if ((v = lookup(&c)) < 0) {
+            w->missing = 1;
+            return;
+          }
+          v = v > 0 ? v + 1 : 0;
+          if (best == NO_CONV || rank_of(v) > rank_of(best))
+            best = v;
+        } else {
+          if (in_check_b(&c, b.turn))
+            break;
+          /* symmetric moves of symmetric positions lead to one index */
+          q = index_of(w->t, c.sq, c.turn);
+          for (j = 0; j < n && next[j] != q; j++)
+            ;
+          if (j == n)
+            next[n++] = q;
+        }
+        moves++;
+      }
+    }
+  }
+
+  w->cnt[k]  = n;
+  w->conv[k] = best;
+  if (best != NO_CONV && best > (int)w->found)
+    w->found = best;
+  if (!moves)
+    w->t->data[k] = in_check_b(&b, b.turn) ? 1 : 0;
+}
+
+static void *
+work_init(void *arg)
+{
+  Work *w = arg;
+  for (uint64_t k = w->from; k < w->to; k++)
+    init_position(w, k);
+  return NULL;
+}
+
+/* Resolves positions whose best value is reached by a capture or promotion,
+   losses only once every other move is known to lose. */
+static void *
+work_scan(void *arg)
+{
+  Work *w = arg;
+  uint8_t *data = w->t->data;
+
+  for (uint64_t k = w->from; k < w->to; k++)
+    if (!data[k] && w->conv[k] == w->value && (!(w->value & 1) || !w->cnt[k]))
+      data[k] = w->value;
+  return NULL;
+}
+
+/* Resolves predecessors of positions of value, which win if these lose
+   and lose if every move leads to a win. */
+static void *
+work_retro(void *arg)
+{
+  Work *w = arg;
+  Table *t = w->t;
+  int v = w->value, n, j;
+  uint64_t prev[256], q;
+  Board b;
+  U64 from;
+
+  for (uint64_t k = w->from; k < w->to; k++) {
+    if (__atomic_load_n(&t->data[k], __ATOMIC_RELAXED) != v)
+      continue;
+    w->found++;
+    decode(t, k, &b);
+    b.turn = !b.turn;
+    n = 0;
+    for (int i = 0; i < b.n; i++) {
+      if (b.color[i] != b.turn)
+        continue;
+      Square sq = b.sq[i];
+      from = sources(&b, i);
+      while (from) {
+        b.sq[i] = pop_lsb(&from);
+        /* each index is counted once, as by init_position */
+        if ((q = index_of(t, b.sq, b.turn)) == NO_INDEX)
+          continue;
+        for (j = 0; j < n && prev[j] != q; j++)
+          ;
+        if (j == n)
+          prev[n++] = q;
+      }
+      b.sq[i] = sq;
+    }
+    for (j = 0; j < n; j++) {
+      q = prev[j];
+      if (__atomic_load_n(&t->data[q], __ATOMIC_RELAXED))
+        continue;
+      if (v & 1)
+        __atomic_store_n(&t->data[q], v + 1, __ATOMIC_RELAXED);
+      else if (!__atomic_sub_fetch(&w->cnt[q], 1, __ATOMIC_RELAXED)
+           &&  (w->conv[q] == NO_CONV || ((w->conv[q] & 1) && w->conv[q] <= v + 1)))
+        __atomic_store_n(&t->data[q], v + 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+/* Runs fn over both sides of table split among threads, returns sum of
+   found, or its max for init. */
+static uint64_t
+run(void *(*fn)(void *), Work *w, int nthreads, int value)
+{
+  pthread_t handles[GEN_THREADS];
+  uint64_t n = 2 * w[0].t->size, found = 0;
+
+  for (int i = 0; i < nthreads; i++) {
+    w[i]       = w[0];
+    w[i].from  = n * i / nthreads;
+    w[i].to    = n * (i + 1) / nthreads;
+    w[i].value   = value;
+    w[i].found   = 0;
+    w[i].missing = 0;
+  }
+  for (int i = 1; i < nthreads; i++)
+    pthread_create(handles + i, NULL, fn, w + i);
+  fn(w);
+  for (int i = 1; i < nthreads; i++)
+    pthread_join(handles[i], NULL);
+
+  for (int i = 0; i < nthreads; i++)
+    found = fn == work_init ? (w[i].found > found ? w[i].found : found)
+                            : found + w[i].found;
+  return found;
+}
+
+static int
+load_table(Table *t, const char *dir)
+{
+  char file[4096];
+  struct stat st;
+  const uint32_t *header;
+  uint64_t blocks = (2 * t->size + BLOCK - 1) / BLOCK, start = 16 + 4 * (blocks + 1);
+  int fd;
+
+  snprintf(file, sizeof(file), "%s/%s.egtb", dir, t->name);
+  if ((fd = open(file, O_RDONLY)) < 0)
+    return 0;
+  if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < start
+  ||  (t->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    t->map = NULL;
+    close(fd);
+    return 0;
+  }
+  close(fd);
+  header = t->map;
+  if (header[0] != MAGIC || header[1] != t->size || header[2] != BLOCK
+  ||  header[3] != blocks || start + header[4 + blocks] != (uint64_t)st.st_size) {
+    munmap(t->map, st.st_size);
+    t->map = NULL;
+    return 0;
+  }
+  t->map_size = st.st_size;
+  t->offset   = header + 4;
+  t->blocks   = (const uint8_t *)t->map + start;
+  if (t->n > egtb_largest)
+    egtb_largest = t->n;
+  return 1;
+}
+
+/* Writes n values to out as a block, returns its length. */
+static size_t
+pack_block(const uint8_t *values, int n, uint8_t *out)
+{
+  int colors = 0, bits = 0, code[256];
+  uint8_t *codes;
+  size_t len;
+
+  memset(code, -1, sizeof(code));
+  for (int i = 0; i < n; i++)
+    if (values[i] != ILLEGAL && code[values[i]] < 0) {
+      code[values[i]]   = colors;
+      out[1 + colors++] = values[i];
+    }
+  /* impossible positions take the first value */
+  if (!colors)
+    out[1 + colors++] = 0;
+  out[0] = colors;
+  while ((1 << bits) < colors)
+    bits++;
+
+  codes = out + 1 + colors;
+  len   = bits ? (n * bits + 7) / 8 + 1 : 0;
+  memset(codes, 0, len);
+  for (int i = 0; bits && i < n; i++) {
+    unsigned bit  = i * bits;
+    unsigned word = (values[i] == ILLEGAL ? 0 : code[values[i]]) << (bit & 7);
+    codes[bit >> 3]       |= word;
+    codes[(bit >> 3) + 1] |= word >> 8;
+  }
+  return 1 + colors + len;
+}
+
+static void
+generate(Table *t, const char *dir, int nthreads)
+{
+  Work w[GEN_THREADS];
+  uint64_t n = 2 * t->size, found, blocks = (n + BLOCK - 1) / BLOCK, len = 0;
+  uint32_t header[4] = { MAGIC, t->size, BLOCK, blocks }, *offset;
+  int start = get_time(), max_conv, v, max_value = 0;
+  uint8_t *packed;
+  char file[4096];
+  FILE *f;
+
+  w[0].t       = t;
+  w[0].missing = 0;
+  w[0].cnt     = malloc(n);
+  w[0].conv    = malloc(n);
+  t->data      = malloc(n);
+  if (!w[0].cnt || !w[0].conv || !t->data) {
+    printf("cannot allocate %s\n", t->name);
+    exit(1);
+  }
+
+  max_conv = run(work_init, w, nthreads, 0);
+  for (int i = 0; i < nthreads; i++)
+    if (w[i].missing) {
+      printf("cannot generate %s, a table it leads to is not loaded\n", t->name);
+      exit(1);
+    }
+  for (v = 1; v < ILLEGAL - 1; v++) {
+    if (v > 1)
+      run(work_scan, w, nthreads, v);
+    found = run(work_retro, w, nthreads, v);
+    if (found)
+      max_value = v;
+    if (!found && v >= max_conv)
+      break;
+  }
+  free(w[0].cnt);
+  free(w[0].conv);
+
+  /* a block takes at most its palette, a byte of each value and 2 more */
+  offset = malloc(4 * (blocks + 1));
+  packed = malloc(blocks * (BLOCK + 258));
+  if (!offset || !packed) {
+    printf("cannot allocate %s\n", t->name);
+    exit(1);
+  }
+  for (uint64_t i = 0; i < blocks; i++) {
+    offset[i] = len;
+    len += pack_block(t->data + i * BLOCK, i < blocks - 1 ? BLOCK : n - i * BLOCK,
+                      packed + len);
+  }
+  offset[blocks] = len;
+
+  snprintf(file, sizeof(file), "%s/%s.egtb", dir, t->name);
+  if (!(f = fopen(file, "wb"))
+  ||  fwrite(header, sizeof(header), 1, f) != 1
+  ||  fwrite(offset, 4, blocks + 1, f) != blocks + 1
+  ||  fwrite(packed, 1, len, f) != len) {
+    printf("cannot write %s\n", file);
+    exit(1);
+  }
+  fclose(f);
+  free(offset);
+  free(packed);
+
+  /* tables in use are mapped, so that they stay out of memory */
+  free(t->data);
+  t->data = NULL;
+  if (!load_table(t, dir)) {
+    printf("cannot map %s\n", file);
+    exit(1);
+  }
+  printf("%s: %lu positions, %lu bytes, longest mate %d plies, %d ms\n",
+         t->name, n, 16 + 4 * (blocks + 1) + len, max_value - 1, get_time() - start);
+  fflush(stdout);
+}
+
+void
+egtb_generate(const char *dir, int threads)
+{
+  init_materials();
+  egtb_free();
+  threads = threads < 1 ? 1 : threads > GEN_THREADS ? GEN_THREADS : threads;
+  for (int i = 0; i < ntables; i++)
+    generate(tables + i, dir, threads);
+}
+
+void
+egtb_free(void)
+{
+  for (int i = 0; i < ntables; i++) {
+    if (tables[i].map)
+      munmap(tables[i].map, tables[i].map_size);
+    free(tables[i].data);
+    tables[i].map  = NULL;
+    tables[i].data = NULL;
+  }
+  egtb_largest = 0;
+}
+
+int
+egtb_init(const char *dir)
+{
+  int n = 0;
+
+  init_materials();
+  egtb_free();
+  if (!*dir || !strcmp(dir, "<empty>"))
+    return 0;
+  for (int i = 0; i < ntables; i++)
+    n += load_table(tables + i, dir);
+  return n;
+}
+
+int
+egtb_probe(const Position *pos, int *value)
+{
+  U64 occ = ~pos->empty;
+  Board b;
+  int v;
+
+  if (popcount(occ) > egtb_largest || pos->st->castle
+  ||  pos->st->en_passant != SQ_NONE)
+    return 0;
+
+  for (b.n = 0; occ; b.n++) {
+    b.sq[b.n]    = pop_lsb(&occ);
+    b.type[b.n]  = pos->board[b.sq[b.n]];
+    b.color[b.n] = (pos->color[BLACK] >> b.sq[b.n]) & 1;
+  }
+  b.turn = pos->turn;
+  if ((v = lookup(&b)) < 0)
+    return 0;
+
+  *value = !v ? 0 : v & 1 ? v - 1 - MATE_VALUE : MATE_VALUE - (v - 1);
+  return 1;
+}
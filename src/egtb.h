@@ -0,0 +1,23 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __EGTB_H__
+#define __EGTB_H__
+
+#include "chesslib.h"
+#include "position.h"
+
+#define EGTB_PIECES 4 /* max pieces of own tables, kings included */
+
+extern int egtb_largest; /* pieces of largest table loaded, 0 if none */
+
+/* Generates tables of all materials of 3 to EGTB_PIECES pieces into dir,
+   using given number of threads. Tables are generated from the smallest, as
+   captures and promotions lead into them, and stay loaded. */
+void egtb_generate(const char *dir, int threads);
+/* Maps tables found in dir, unmaps previous ones. Returns number of tables. */
+int egtb_init(const char *dir);
+void egtb_free(void);
+/* Returns 1 and sets *value to value of pos in perfect play, with mates
+   counted from pos, or returns 0 if pos is not in tables. */
+int egtb_probe(const Position *pos, int *value);
+
+#endif /* __EGTB_H__ */
@@ -0,0 +1,65 @@
+/* Evaluation parameters, generated by tuner. */
+const EvalParams eval_params = {
+  .pawn_pcsq = {
+    {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0},
+    {   3,   7}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   3,   7},
+    {   2,   6}, {   0,   4}, {   0,   4}, {   0,   4}, {   0,   4}, {   0,   4}, {   0,   4}, {   2,   6},
+    {   1,   5}, {   0,   3}, {   0,   3}, {   0,   3}, {   0,   3}, {   0,   3}, {   0,   3}, {   1,   5},
+    {   1,   4}, {   0,   2}, {   5,   2}, {  20,   2}, {  20,   2}, {   5,   2}, {   0,   2}, {   1,   4},
+    {   5,   3}, {  10,   1}, {   0,   1}, {  10,   1}, {  10,   1}, {  -5,   1}, {  10,   1}, {   5,   3},
+    {  10,   2}, {  10,   0}, {   9,   0}, {   5,   0}, {   5,   0}, {  10,   0}, {  10,   0}, {  10,   2},
+    {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0},
+  },
+  .passed = {
+    {   0,   0}, {  53, 100}, {  31,  45}, {  15,  22}, {   8,  14}, {   5,   9}, {   2,   5}, {   0,   0},
+  },
+  .isolated = { -10, -20 },
+  .doubled = { -10, -25 },
+  .knight_pcsq = {
+    { -15, -25}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, { -15, -25},
+    { -10, -20}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, { -10, -20},
+    { -10, -20}, {   0,   0}, {  10,   0}, {  10,   0}, {  10,   0}, {  10,   0}, {   0,   0}, { -10, -20},
+    { -10, -20}, {   5,   0}, {  10,   0}, {  20,   0}, {  20,   0}, {  10,   0}, {   5,   0}, { -10, -20},
+    { -10, -20}, {   5,   0}, {  10,   0}, {  20,   0}, {  20,   0}, {  10,   0}, {   5,   0}, { -10, -20},
+    { -10, -20}, {   0,   0}, {  10,   0}, {   5,   0}, {   5,   0}, {  10,   0}, {   0,   0}, { -10, -20},
+    { -10, -20}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, { -10, -20},
+    { -15, -25}, {  -6,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {  -8,   0}, { -15, -25},
+  },
+  .knight_mobility = 1,
+  .bishop_pcsq = {
+    {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0}, {   0,   0},
+    {   0,   0}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   5}, {   0,   0},
+    {   0,   0}, {   0,   5}, {   0,   9}, {   0,   9}, {   0,   9}, {   0,   9}, {   0,   5}, {   0,   0},
+    {   0,   0}, {  18,   5}, {   0,   9}, {   0,   9}, {   0,   9}, {   0,   9}, {  18,   5}, {   0,   0},
+    {   0,   0}, {   0,   5}, {  20,   9}, {  20,   9}, {  20,   9}, {  20,   9}, {   0,   5}, {   0,   0},
+    {   5,   0}, {   0,   5}, {   7,   9}, {  10,   9}, {  10,   9}, {   7,   9}, {   0,   5}, {   5,   0},
+    {   0,   0}, {  10,   5}, {   0,   5}, {   7,   5}, {   7,   5}, {   0,   5}, {  10,   5}, {   0,   0},
+    {   0,   0}, {   0,   0}, {  -6,   0}, {   0,   0}, {   0,   0}, {  -8,   0}, {   0,   0}, {   0,   0},
+  },
+  .bishop_mobility = 1,
+  .outpost = { 15, 10 },
+  .bishop_pair = { 20, 40 },
+  .rook_pcsq = {
+      5,   5,   7,  10,  10,   7,   5,   5,
+     20,  20,  20,  20,  20,  20,  20,  20,
+      0,   0,   5,  10,  10,   5,   0,   0,
+      0,   0,   5,  10,  10,   5,   0,   0,
+      0,   0,   5,  10,  10,   5,   0,   0,
+      0,   0,   5,  10,  10,   5,   0,   0,
+      0,   0,   5,  10,  10,   5,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+  },
+  .open_file = { 10, 30 },
+  .king_file = 10,
+  .king_pcsq = {
+    { -10, -50}, { -10, -20}, { -10, -20}, { -10, -20}, { -10, -20}, { -10, -20}, { -10, -20}, { -10, -50},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    { -10, -10}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10,   0}, { -10, -10},
+    {  10, -50}, {  20, -20}, {  20, -20}, { -10, -20}, {   0, -20}, { -10, -20}, {  20, -20}, {  20, -50},
+  },
+  .king_shield = { 2, 5 },
+};
@@ -4,7 +4,40 @@
 
 #include "position.h"
 
+/* Max difference between full evaluation and material, found by microbench
+   over positions reachable from its corpus. */
+#define LAZY_MARGIN 300
+
+/* Weights of evaluation terms, [2] are for middlegame and endgame unless
+   noted otherwise. Values are generated by tuner into evalparams.h. */
+typedef struct {
+  int pawn_pcsq[64][2];
+  int passed[8][2];     /* by rank */
+  int isolated[2];
+  int doubled[2];
+  int knight_pcsq[64][2];
+  int knight_mobility;  /* per attacked square */
+  int bishop_pcsq[64][2];
+  int bishop_mobility;
+  int outpost[2];
+  int bishop_pair[2];
+  int rook_pcsq[64];
+  int open_file[2];     /* semiopen, open */
+  int king_file;        /* rook on file or rank of enemy king */
+  int king_pcsq[64][2];
+  int king_shield[2];   /* per pawn next to king */
+} EvalParams;
+
+#define NUM_PARAMS ((int)(sizeof(EvalParams) / sizeof(int)))
+
+extern const EvalParams eval_params;
+
 void initialise_evaluation(void);
-int evaluate(const Position *pos);
+/* Returns value of pos for side to move. If material alone is LAZY_MARGIN
+   beyond the window, only a bound outside of it is returned. */
+int evaluate(const Position *pos, int alpha, int beta);
+/* Returns classical evaluation of pos for white, fills trace with number of
+   times each parameter is added to it, for the tuner. */
+int evaluate_trace(const Position *pos, int *trace);
 
 #endif /* __EVALUATE_H__ */
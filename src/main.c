@@ -1,41 +1,47 @@
 /* See LICENSE file for file for copyright and license details */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "bench.h"
 #include "bitboards.h"
+#include "datagen.h"
 #include "chesslib.h"
+#include "egtb.h"
 #include "evaluate.h"
 #include "position.h"
+#include "search.h"
 #include "uci.h"
 
-/* commonly used bitboards */
-const U64 FileABB = 0x0101010101010101ULL;
-const U64 FileBBB = FileABB << 1;
-const U64 FileCBB = FileABB << 2;
-const U64 FileDBB = FileABB << 3;
-const U64 FileEBB = FileABB << 4;
-const U64 FileFBB = FileABB << 5;
-const U64 FileGBB = FileABB << 6;
-const U64 FileHBB = FileABB << 7;
-
-const U64 Rank1BB = 0xFF00000000000000ULL;
-const U64 Rank2BB = Rank1BB >> 8;
-const U64 Rank3BB = Rank2BB >> 8;
-const U64 Rank4BB = Rank3BB >> 8;
-const U64 Rank5BB = Rank4BB >> 8;
-const U64 Rank6BB = Rank5BB >> 8;
-const U64 Rank7BB = Rank6BB >> 8;
-const U64 Rank8BB = Rank7BB >> 8;
-
 int
-main(/* int argc, char *argv[] */)
+main(int argc, char *argv[])
 {
   printf("Botstasiu alpha by Stanisław Bitner\n");
 
   initialise_bitboards();
   initialise_zobrist_keys();
   initialise_evaluation();
+  initialise_search();
 
-  uci_loop();
+  /* bench [depth] [hash] [threads] */
+  if (argc > 1 && !strcmp(argv[1], "bench"))
+    bench(argc > 2 ? atoi(argv[2]) : 10,
+          argc > 3 ? atoi(argv[3]) : 16,
+          argc > 4 ? atoi(argv[4]) : 1);
+  /* datagen file [games] [depth] [seed] */
+  else if (argc > 2 && !strcmp(argv[1], "datagen"))
+    datagen(argv[2],
+            argc > 3 ? atoi(argv[3]) : 100,
+            argc > 4 ? atoi(argv[4]) : 6,
+            argc > 5 ? strtoull(argv[5], NULL, 10) : 0);
+  /* egtbgen dir [threads] */
+  else if (argc > 2 && !strcmp(argv[1], "egtbgen"))
+    egtb_generate(argv[2], argc > 3 ? atoi(argv[3]) : 1);
+  /* tbcheck syzygypath egtbdir [positions] */
+  else if (argc > 3 && !strcmp(argv[1], "tbcheck"))
+    tb_check(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 10000);
+  else
+    uci_loop();
 
   delete_bitboards();
   return 0;
@@ -0,0 +1,243 @@
+/* See LICENSE file for file for copyright and license details */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#undef INFINITY /* chesslib.h has its own */
+
+#include "bench.h"
+#include "bitboards.h"
+#include "chesslib.h"
+#include "evaluate.h"
+#include "movegen.h"
+#include "moveorder.h"
+#include "position.h"
+#include "tt.h"
+
+#define SAMPLES 20    /* timed samples of each primitive */
+#define T95     2.093 /* two sided 95% quantile of t distribution, 19 dof */
+#define PASSES  200   /* passes over corpus in one sample */
+#define MAX_DIFF 4096  /* bins of histogram of positional terms */
+
+/* Position of corpus with its move lists prepared in advance. */
+typedef struct {
+  Position pos;
+  Move     pseudo[256]; /* pseudo legal moves */
+  int      npseudo;
+  Move     legal[256];  /* legal moves with their values */
+  int      nlegal;
+} Sample;
+
+/* Runs primitive on position, returns number of operations done. */
+typedef int (*Primitive)(Sample *s, int arg);
+
+static Sample  *corpus;
+static uint64_t sink; /* results of primitives, so that they are not optimized out */
+
+static uint64_t
+ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int
+gen(Sample *s, int gt)
+{
+  Move move_list[256];
+  sink += generate_moves(gt, move_list, &s->pos) - move_list;
+  return 1;
+}
+
+static int
+make_unmake(Sample *s, int arg)
+{
+  (void)arg;
+  for (int i = 0; i < s->nlegal; i++) {
+    do_move(&s->pos, move_of(s->legal[i]));
+    sink += s->pos.key;
+    undo_move(&s->pos, move_of(s->legal[i]));
+  }
+  return s->nlegal;
+}
+
+static int
+legal(Sample *s, int arg)
+{
+  (void)arg;
+  for (int i = 0; i < s->npseudo; i++)
+    sink += is_legal(&s->pos, s->pseudo[i]);
+  return s->npseudo;
+}
+
+static int
+attackers(Sample *s, int arg)
+{
+  U64 occ = ~s->pos.empty;
+  (void)arg;
+  for (Square sq = SQ_A8; sq <= SQ_H1; sq++)
+    sink += attackers_to(&s->pos, sq, occ);
+  return 64;
+}
+
+/* Evaluates with full window, or with null window that far below material
+   that evaluation exits lazily. */
+static int
+eval(Sample *s, int lazy)
+{
+  int m = s->pos.material[s->pos.turn] - s->pos.material[!s->pos.turn];
+  sink += lazy ? evaluate(&s->pos, m - 2 * LAZY_MARGIN, m - 2 * LAZY_MARGIN + 1)
+               : evaluate(&s->pos, -INFINITY, INFINITY);
+  return 1;
+}
+
+static int
+attacks(Sample *s, int pt)
+{
+  U64 occ = ~s->pos.empty;
+  for (Square sq = SQ_A8; sq <= SQ_H1; sq++)
+    sink += pt == PAWN ? pawn_attacks_bb(s->pos.turn, sq)
+                       : attacks_bb(pt, sq, occ);
+  return 64;
+}
+
+/* Sorts a copy of scored legal moves, copying is included in the time. */
+static int
+sort(Sample *s, int arg)
+{
+  Move move_list[256];
+  (void)arg;
+  memcpy(move_list, s->legal, s->nlegal * sizeof(Move));
+  sort_moves(move_list, move_list + s->nlegal);
+  sink += move_list[0];
+  return 1;
+}
+
+/* Adds difference of full evaluation and material of positions up to depth
+   plies from pos to histogram. */
+static void
+positional_terms(Position *pos, int depth, uint64_t *hist)
+{
+  Move move_list[256], *last;
+  int d = evaluate(pos, -INFINITY, INFINITY)
+        - (pos->material[pos->turn] - pos->material[!pos->turn]);
+
+  hist[abs(d) < MAX_DIFF ? abs(d) : MAX_DIFF - 1]++;
+  if (!depth)
+    return;
+  last = generate_moves(ALL, move_list, pos);
+  last = process_moves(pos, move_list, last, MOVE_NONE);
+  for (Move *m = move_list; m != last; m++) {
+    do_move(pos, move_of(*m));
+    positional_terms(pos, depth - 1, hist);
+    undo_move(pos, move_of(*m));
+  }
+}
+
+/* Lazy evaluation returns a wrong bound whenever positional terms exceed
+   LAZY_MARGIN, prints how they are distributed so the margin can be checked. */
+static void
+check_lazy_margin(void)
+{
+  static uint64_t hist[MAX_DIFF];
+  static const double q[] = { 0.5, 0.99, 0.999, 1.0 };
+  uint64_t n = 0, sum = 0;
+  int d = 0;
+
+  for (int i = 0; i < bench_nfens; i++)
+    positional_terms(&corpus[i].pos, 2, hist);
+  for (int i = 0; i < MAX_DIFF; i++)
+    n += hist[i];
+
+  printf("\n%lu positions, |eval - material| quantiles:", n);
+  for (int k = 0; k < 4; k++) {
+    for (; sum + hist[d] < q[k] * n; d++)
+      sum += hist[d];
+    printf(" %.1f%% %d%s", 100 * q[k], d, d == MAX_DIFF - 1 ? "+" : "");
+  }
+  for (sum = 0, d = LAZY_MARGIN + 1; d < MAX_DIFF; d++)
+    sum += hist[d];
+  printf("\nabove LAZY_MARGIN %d: %lu\n", LAZY_MARGIN, sum);
+}
+
+/* Prints mean time of one operation of primitive with its 95% confidence
+   interval. First sample warms up caches and is not counted. */
+static void
+measure(const char *name, Primitive f, int arg)
+{
+  double x[SAMPLES], mean = 0, var = 0;
+  uint64_t start, ops;
+
+  for (int k = -1; k < SAMPLES; k++) {
+    ops = 0;
+    start = ns();
+    for (int p = 0; p < PASSES; p++)
+      for (int i = 0; i < bench_nfens; i++)
+        ops += f(&corpus[i], arg);
+    if (k >= 0)
+      x[k] = (double)(ns() - start) / ops;
+  }
+
+  for (int k = 0; k < SAMPLES; k++)
+    mean += x[k] / SAMPLES;
+  for (int k = 0; k < SAMPLES; k++)
+    var += (x[k] - mean) * (x[k] - mean) / (SAMPLES - 1);
+
+  printf("%-24s %10.2f +- %6.2f\n", name, mean, T95 * sqrt(var / SAMPLES));
+}
+
+int
+main(void)
+{
+  Move *last;
+
+  initialise_bitboards();
+  initialise_zobrist_keys();
+  initialise_evaluation();
+
+  if (!(corpus = calloc(bench_nfens, sizeof(Sample)))) {
+    printf("cannot allocate corpus\n");
+    return 1;
+  }
+  for (int i = 0; i < bench_nfens; i++) {
+    Sample *s = corpus + i;
+    set_position(&s->pos, bench_fens[i]);
+    /* primitives do not touch the table */
+    tt_delete(s->pos.tt);
+    s->pos.tt = NULL;
+
+    s->npseudo = generate_moves(ALL, s->pseudo, &s->pos) - s->pseudo;
+    memcpy(s->legal, s->pseudo, s->npseudo * sizeof(Move));
+    last = process_moves(&s->pos, s->legal, s->legal + s->npseudo, MOVE_NONE);
+    s->nlegal = last - s->legal;
+  }
+
+  printf("%d positions, %d samples of %d passes\n", bench_nfens, SAMPLES, PASSES);
+  printf("%-24s %10s    %6s\n", "primitive", "ns/op", "95% ci");
+  measure("generate_moves ALL",      gen,         ALL);
+  measure("generate_moves QUIET",    gen,         QUIET);
+  measure("generate_moves CAPTURES", gen,         CAPTURES);
+  measure("do_move + undo_move",     make_unmake, 0);
+  measure("is_legal",                legal,       0);
+  measure("attackers_to",            attackers,   0);
+  measure("evaluate",                eval,        0);
+  measure("evaluate lazy exit",      eval,        1);
+  measure("pawn_attacks_bb",         attacks,     PAWN);
+  measure("attacks_bb KNIGHT",       attacks,     KNIGHT);
+  measure("attacks_bb BISHOP",       attacks,     BISHOP);
+  measure("attacks_bb ROOK",         attacks,     ROOK);
+  measure("attacks_bb QUEEN",        attacks,     QUEEN);
+  measure("attacks_bb KING",         attacks,     KING);
+  measure("sort_moves",              sort,        0);
+
+  check_lazy_margin();
+
+  if (!sink)
+    printf("\n");
+
+  free(corpus);
+  delete_bitboards();
+  return 0;
+}
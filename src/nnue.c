@@ -0,0 +1,237 @@
+/* See LICENSE file for file for copyright and license details */
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "chesslib.h"
+#include "nnue.h"
+
+#define PAD(size) (((size) + 63) & ~(size_t)63)
+
+/* Network mapped from file. */
+static struct {
+  void          *map;
+  size_t         size;
+  const int16_t *ft_weights;
+  const int16_t *ft_biases;
+  const int8_t  *l1_weights;
+  const int32_t *l1_biases;
+  const int8_t  *l2_weights;
+  const int32_t *l2_biases;
+  const int8_t  *out_weights;
+  const int32_t *out_bias;
+} net;
+
+int
+nnue_load(const char *file)
+{
+  struct stat st;
+  const NNUEHeader *h;
+  const char *p;
+  void *map;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) < 0
+  ||  (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  h = map;
+  if ((size_t)st.st_size != PAD(sizeof(NNUEHeader))
+                          + PAD(sizeof(int16_t) * NNUE_INPUTS * NNUE_HIDDEN)
+                          + PAD(sizeof(int16_t) * NNUE_HIDDEN)
+                          + PAD(sizeof(int8_t)  * NNUE_L1 * 2 * NNUE_HIDDEN)
+                          + PAD(sizeof(int32_t) * NNUE_L1)
+                          + PAD(sizeof(int8_t)  * NNUE_L2 * NNUE_L1)
+                          + PAD(sizeof(int32_t) * NNUE_L2)
+                          + PAD(sizeof(int8_t)  * NNUE_L2)
+                          + PAD(sizeof(int32_t))
+  ||  h->magic != NNUE_MAGIC || h->version != NNUE_VERSION
+  ||  h->inputs != NNUE_INPUTS || h->hidden != NNUE_HIDDEN
+  ||  h->l1 != NNUE_L1 || h->l2 != NNUE_L2) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  nnue_unload();
+  net.map  = map;
+  net.size = st.st_size;
+
+  p = (const char *)map + PAD(sizeof(NNUEHeader));
+  net.ft_weights  = (const int16_t *)p; p += PAD(sizeof(int16_t) * NNUE_INPUTS * NNUE_HIDDEN);
+  net.ft_biases   = (const int16_t *)p; p += PAD(sizeof(int16_t) * NNUE_HIDDEN);
+  net.l1_weights  = (const int8_t  *)p; p += PAD(sizeof(int8_t)  * NNUE_L1 * 2 * NNUE_HIDDEN);
+  net.l1_biases   = (const int32_t *)p; p += PAD(sizeof(int32_t) * NNUE_L1);
+  net.l2_weights  = (const int8_t  *)p; p += PAD(sizeof(int8_t)  * NNUE_L2 * NNUE_L1);
+  net.l2_biases   = (const int32_t *)p; p += PAD(sizeof(int32_t) * NNUE_L2);
+  net.out_weights = (const int8_t  *)p; p += PAD(sizeof(int8_t)  * NNUE_L2);
+  net.out_bias    = (const int32_t *)p;
+  return 0;
+}
+
+void
+nnue_unload(void)
+{
+  if (net.map)
+    munmap(net.map, net.size);
+  memset(&net, 0, sizeof(net));
+}
+
+int
+nnue_loaded(void)
+{
+  return net.map != NULL;
+}
+
+void
+nnue_reset(Accumulator *acc)
+{
+  if (!net.map)
+    return;
+  memcpy(acc->v[WHITE], net.ft_biases, sizeof(acc->v[WHITE]));
+  memcpy(acc->v[BLACK], net.ft_biases, sizeof(acc->v[BLACK]));
+}
+
+/* Adds or subtracts weights of a feature from accumulator of a perspective. */
+static inline void
+update(int16_t *acc, const int16_t *w, int add)
+{
+#if defined(__AVX2__)
+  for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(w + i));
+    a = add ? _mm256_add_epi16(a, b) : _mm256_sub_epi16(a, b);
+    _mm256_storeu_si256((__m256i *)(acc + i), a);
+  }
+#elif defined(__SSE4_1__)
+  for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(w + i));
+    a = add ? _mm_add_epi16(a, b) : _mm_sub_epi16(a, b);
+    _mm_storeu_si128((__m128i *)(acc + i), a);
+  }
+#else
+  for (int i = 0; i < NNUE_HIDDEN; i++)
+    acc[i] += add ? w[i] : -w[i];
+#endif
+}
+
+void
+nnue_add(Accumulator *acc, PieceType pt, Color c, Square sq)
+{
+  if (!net.map)
+    return;
+  update(acc->v[WHITE], net.ft_weights + nnue_feature(pt, c, sq, WHITE) * NNUE_HIDDEN, 1);
+  update(acc->v[BLACK], net.ft_weights + nnue_feature(pt, c, sq, BLACK) * NNUE_HIDDEN, 1);
+}
+
+void
+nnue_rem(Accumulator *acc, PieceType pt, Color c, Square sq)
+{
+  if (!net.map)
+    return;
+  update(acc->v[WHITE], net.ft_weights + nnue_feature(pt, c, sq, WHITE) * NNUE_HIDDEN, 0);
+  update(acc->v[BLACK], net.ft_weights + nnue_feature(pt, c, sq, BLACK) * NNUE_HIDDEN, 0);
+}
+
+/* Clips n values of accumulator to [0, 127]. */
+static inline void
+crelu(const int16_t *in, uint8_t *out, int n)
+{
+#if defined(__AVX2__)
+  const __m256i max = _mm256_set1_epi16(127);
+  for (int i = 0; i < n; i += 32) {
+    __m256i a = _mm256_min_epi16(_mm256_loadu_si256((const __m256i *)(in + i)), max);
+    __m256i b = _mm256_min_epi16(_mm256_loadu_si256((const __m256i *)(in + i + 16)), max);
+    /* packus works within 128 bit lanes, permute restores the order */
+    __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i *)(out + i), r);
+  }
+#elif defined(__SSE4_1__)
+  const __m128i max = _mm_set1_epi16(127);
+  for (int i = 0; i < n; i += 16) {
+    __m128i a = _mm_min_epi16(_mm_loadu_si128((const __m128i *)(in + i)), max);
+    __m128i b = _mm_min_epi16(_mm_loadu_si128((const __m128i *)(in + i + 8)), max);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+  }
+#else
+  for (int i = 0; i < n; i++)
+    out[i] = in[i] < 0 ? 0 : in[i] > 127 ? 127 : in[i];
+#endif
+}
+
+/* Returns dot product of n activations and weights, n is multiple of 32. */
+static inline int32_t
+dot(const uint8_t *a, const int8_t *w, int n)
+{
+#if defined(__AVX2__)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+  __m128i s;
+  for (int i = 0; i < n; i += 32) {
+    /* pairs of products fit into int16, as activations are below 128 */
+    __m256i p = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(w + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+  }
+  s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+  return _mm_cvtsi128_si32(s);
+#elif defined(__SSE4_1__)
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < n; i += 16) {
+    __m128i p = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(a + i)),
+                                  _mm_loadu_si128((const __m128i *)(w + i)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(p, ones));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+  return _mm_cvtsi128_si32(sum);
+#else
+  int32_t sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += a[i] * w[i];
+  return sum;
+#endif
+}
+
+/* Computes clipped outputs of a hidden layer. */
+static inline void
+layer(const uint8_t *in, int n, const int8_t *w, const int32_t *b,
+      uint8_t *out, int m)
+{
+  int32_t v;
+  for (int o = 0; o < m; o++) {
+    v = (b[o] + dot(in, w + o * n, n)) >> NNUE_SHIFT;
+    out[o] = v < 0 ? 0 : v > 127 ? 127 : v;
+  }
+}
+
+int
+nnue_evaluate(const Accumulator *acc, Color stm)
+{
+  uint8_t in[2 * NNUE_HIDDEN], h1[NNUE_L1], h2[NNUE_L2];
+  int64_t v;
+
+  /* side to move comes first */
+  crelu(acc->v[stm],  in,               NNUE_HIDDEN);
+  crelu(acc->v[!stm], in + NNUE_HIDDEN, NNUE_HIDDEN);
+
+  layer(in, 2 * NNUE_HIDDEN, net.l1_weights, net.l1_biases, h1, NNUE_L1);
+  layer(h1, NNUE_L1,         net.l2_weights, net.l2_biases, h2, NNUE_L2);
+
+  v = (int64_t)(*net.out_bias + dot(h2, net.out_weights, NNUE_L2))
+    * NNUE_SCALE / (127 << NNUE_SHIFT);
+  return v < -NNUE_BOUND ? -NNUE_BOUND : v > NNUE_BOUND ? NNUE_BOUND : v;
+}
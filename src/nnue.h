@@ -0,0 +1,69 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __NNUE_H__
+#define __NNUE_H__
+
+#include <inttypes.h>
+
+#include "chesslib.h"
+
+#define NNUE_INPUTS 768 /* [own or enemy][PieceType][Square] of perspective */
+#define NNUE_HIDDEN 256 /* size of accumulator of one perspective */
+#define NNUE_L1     32
+#define NNUE_L2     32
+#define NNUE_FILE   "botstasiu.nnue"
+
+#define NNUE_MAGIC   0x45554E42 /* "BNUE" */
+#define NNUE_VERSION 1
+
+/*
+ * Quantization of network file:
+ * feature transformer - int16 weights and biases, activation 1.0 is 127
+ * hidden layers       - int8 weights scaled by 64, int32 biases scaled by
+ *                       127 * 64, outputs shifted back and clipped to 127
+ * output              - same as hidden layers, 1.0 is NNUE_SCALE centipawns
+ */
+#define NNUE_SHIFT 6
+#define NNUE_SCALE 600
+#define NNUE_BOUND 10000 /* of output, far from mate and tablebase values */
+
+/* Header of network file. It is followed by blocks of feature weights
+   [NNUE_INPUTS][NNUE_HIDDEN], feature biases, l1 weights
+   [NNUE_L1][2 * NNUE_HIDDEN], l1 biases, l2 weights [NNUE_L2][NNUE_L1], l2
+   biases, output weights [NNUE_L2] and output bias, each padded to 64 bytes. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t inputs;
+  uint32_t hidden;
+  uint32_t l1;
+  uint32_t l2;
+  uint32_t unused[10];
+} NNUEHeader;
+
+/* First layer of network for both perspectives. */
+typedef struct {
+  int16_t v[2][NNUE_HIDDEN]; /* [Color] */
+} Accumulator;
+
+/* Maps network from file, returns 0 on success. Positions set before have
+   to be set again, as their accumulators are not valid for new network. */
+int nnue_load(const char *file);
+void nnue_unload(void);
+int nnue_loaded(void);
+
+/* Returns index of feature of piece for perspective. */
+static inline int
+nnue_feature(PieceType pt, Color c, Square sq, Color perspective)
+{
+  return ((c != perspective) * 6 + pt) * 64
+       + (perspective == WHITE ? sq : sq ^ 56);
+}
+
+/* Sets accumulator to biases, as on empty board. */
+void nnue_reset(Accumulator *acc);
+void nnue_add(Accumulator *acc, PieceType pt, Color c, Square sq);
+void nnue_rem(Accumulator *acc, PieceType pt, Color c, Square sq);
+/* Returns evaluation in centipawns for side to move, within NNUE_BOUND. */
+int nnue_evaluate(const Accumulator *acc, Color stm);
+
+#endif /* __NNUE_H__ */
@@ -1,4 +1,5 @@
 /* See LICENSE file for file for copyright and license details */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,8 @@
 #include "misc.h"
 #include "position.h"
 
+static inline void set_piece(Position *pos, PieceType pt, Color c, Square sq);
+static inline void clear_piece(Position *pos, PieceType pt, Color c, Square sq);
 static inline void add_piece(Position *pos, PieceType pt, Color c, Square sq);
 static inline void rem_piece(Position *pos, PieceType pt, Color c, Square sq);
 static inline void add_enpas(Position *pos, Square sq);
@@ -27,7 +30,7 @@ static const int update_castle_rights[64] = {
   14, 15, 15, 15, 10, 15, 15, 11,
 };
 
-static const int material_score[] = {
+const int material_score[] = {
   [PAWN]   = 100,
   [KNIGHT] = 300,
   [BISHOP] = 320,
@@ -42,9 +45,9 @@ static Key pieceKey[2][6][64]; /* [Color][PieceType][Square] */
 static Key enpasKey[8];        /* [File] */
 static Key castleKey[16];      /* [CastleMask] */
 
-/* Adds piece to the given square, assumes that nothing is there. */
+/* Puts piece on the given square, assumes that nothing is there. */
 static inline void
-add_piece(Position *pos, PieceType pt, Color c, Square sq)
+set_piece(Position *pos, PieceType pt, Color c, Square sq)
 {
   U64 bb = get_bitboard(sq);
   pos->board[sq]  = pt;
@@ -53,9 +56,9 @@ add_piece(Position *pos, PieceType pt, Color c, Square sq)
   pos->key       ^= pieceKey[c][pt][sq];
 }
 
-/* Removes piece from the given square, assumes that something is there. */
+/* Takes piece from the given square, assumes that something is there. */
 static inline void
-rem_piece(Position *pos, PieceType pt, Color c, Square sq)
+clear_piece(Position *pos, PieceType pt, Color c, Square sq)
 {
   U64 bb = get_bitboard(sq);
   pos->board[sq]  = NONE;
@@ -64,6 +67,27 @@ rem_piece(Position *pos, PieceType pt, Color c, Square sq)
   pos->key       ^= pieceKey[c][pt][sq];
 }
 
+/* Adds piece to the given square and updates evaluation state,
+   undo_move uses set_piece, as previous state is kept on the stack. */
+static inline void
+add_piece(Position *pos, PieceType pt, Color c, Square sq)
+{
+  set_piece(pos, pt, c, sq);
+#ifdef NNUE
+  nnue_add(&pos->acc[pos->ply], pt, c, sq);
+#endif
+}
+
+/* Removes piece from the given square and updates evaluation state. */
+static inline void
+rem_piece(Position *pos, PieceType pt, Color c, Square sq)
+{
+  clear_piece(pos, pt, c, sq);
+#ifdef NNUE
+  nnue_rem(&pos->acc[pos->ply], pt, c, sq);
+#endif
+}
+
 /* Adds en passant. */
 static inline void
 add_enpas(Position *pos, Square sq)
@@ -106,16 +130,17 @@ do_move(Position *pos, Move m)
             captured = pos->board[to];
 
   /* move state to the next one */
-  State *st = malloc(sizeof(State));
-  *st = *(pos->st);
-  st->prev = pos->st;
-  pos->st = st;
+  pos->st[1] = pos->st[0];
+  pos->st++;
   pos->st->captured = captured;
   pos->st->fifty_move_rule++;
   if (pt == PAWN || captured != NONE)
     pos->st->fifty_move_rule = 0;
   pos->reps[pos->game_ply++] = pos->key;
   pos->ply++;
+#ifdef NNUE
+  pos->acc[pos->ply] = pos->acc[pos->ply - 1];
+#endif
 
   /* move is a capture */
   if (captured != NONE) {
@@ -174,34 +199,32 @@ undo_move(Position *pos, Move m)
     if (to - from == 16 || from - to == 16) {
       rem_enpas(pos);
     } else if (type_of(m) == EN_PASSANT) {
-      add_piece(pos, PAWN, them, to + (us == WHITE ? 8 : -8));
+      set_piece(pos, PAWN, them, to + (us == WHITE ? 8 : -8));
       pos->material[them] += material_score[PAWN];
     } else if (type_of(m) == PROMOTION) {
-      rem_piece(pos, promotion_type(m), us, to);
-      add_piece(pos, PAWN, us, to);
+      clear_piece(pos, promotion_type(m), us, to);
+      set_piece(pos, PAWN, us, to);
       pos->material[us] -= material_score[promotion_type(m)] - material_score[PAWN];
     }
   } else if (type_of(m) == CASTLE) {
     if (from < to) {
-      rem_piece(pos, ROOK, us, from + 1);
-      add_piece(pos, ROOK, us, from + 3);
+      clear_piece(pos, ROOK, us, from + 1);
+      set_piece(pos, ROOK, us, from + 3);
     } else {
-      rem_piece(pos, ROOK, us, from - 1);
-      add_piece(pos, ROOK, us, from - 4);
+      clear_piece(pos, ROOK, us, from - 1);
+      set_piece(pos, ROOK, us, from - 4);
     }
   }
 
-  rem_piece(pos, pt, us, to);
-  add_piece(pos, pt, us, from);
+  clear_piece(pos, pt, us, to);
+  set_piece(pos, pt, us, from);
 
   if (captured != NONE) {
-    add_piece(pos, captured, them, to);
+    set_piece(pos, captured, them, to);
     pos->material[them] += material_score[captured];
   }
 
-  State *st = pos->st->prev;
-  free(pos->st);
-  pos->st = st;
+  pos->st--;
   pos->key ^= castleKey[pos->st->castle];
   if (pos->st->en_passant != SQ_NONE)
     add_enpas(pos, pos->st->en_passant);
@@ -215,11 +238,12 @@ void
 do_null_move(Position *pos)
 {
   pos->ply++;
+#ifdef NNUE
+  pos->acc[pos->ply] = pos->acc[pos->ply - 1];
+#endif
   pos->reps[pos->game_ply++] = pos->key;
-  State *st = malloc(sizeof(State));
-  *st = *(pos->st);
-  st->prev = pos->st;
-  pos->st = st;
+  pos->st[1] = pos->st[0];
+  pos->st++;
   rem_enpas(pos);
   switch_turn(pos);
 }
@@ -230,9 +254,7 @@ undo_null_move(Position *pos)
   pos->ply--;
   pos->game_ply--;
   switch_turn(pos);
-  State *st = pos->st->prev;
-  free(pos->st);
-  pos->st = st;
+  pos->st--;
   if (pos->st->en_passant != SQ_NONE)
     add_enpas(pos, pos->st->en_passant);
 }
@@ -280,10 +302,8 @@ void
 set_position(Position *pos, const char *fen)
 {
   pos->game_ply = 0;
-  tt_delete(pos->tt);
-  free(pos->st);
-  pos->st = malloc(sizeof(State));
-  pos->st->prev = NULL;
+  pos->ply = 0;
+  pos->st = pos->states;
   pos->st->captured = NONE;
   pos->st->fifty_move_rule = 0;
   pos->color[WHITE] = pos->color[BLACK] = 0ULL;
@@ -296,6 +316,9 @@ set_position(Position *pos, const char *fen)
   pos->st->en_passant = SQ_NONE;
   pos->st->castle = 0;
   pos->key = 0ULL;
+#ifdef NNUE
+  nnue_reset(&pos->acc[0]);
+#endif
   memset(pos->reps, 0, sizeof(pos->reps));
 
   /* board */
@@ -350,7 +373,11 @@ set_position(Position *pos, const char *fen)
   /* TODO */
   /* fifty move rule */
 
-  pos->tt = tt_new(0x100000 * 2); /* 2 MB */
+  /* table lives for the whole game, it is created anew only on resize */
+  if (!pos->tt || tt_bytes(pos->tt) != 0x100000 * tt_size) {
+    tt_delete(pos->tt);
+    pos->tt = tt_new(0x100000 * tt_size);
+  }
 
   pos->material[WHITE] = pos->material[BLACK] = 0;
   for (PieceType pt = PAWN; pt < KING; pt++)
@@ -359,6 +386,39 @@ set_position(Position *pos, const char *fen)
 
 }
 
+/* Copies position, so that dst can be searched independently of src. */
+void
+copy_position(Position *dst, const Position *src)
+{
+#ifdef NNUE
+  memcpy(dst, src, offsetof(Position, acc));
+  dst->acc[src->ply] = src->acc[src->ply];
+#else
+  memcpy(dst, src, sizeof(Position));
+#endif
+  dst->st = dst->states + (src->st - src->states);
+}
+
+void
+set_root(Position *pos)
+{
+  int keep = pos->st->fifty_move_rule;
+
+#ifdef NNUE
+  pos->acc[0] = pos->acc[pos->ply];
+#endif
+  pos->ply = 0;
+
+  /* repetitions reach back to last capture or pawn move only, older plies
+     are dropped before states run out */
+  if (pos->game_ply >= MAX_GAME_PLY - MAX_SEARCH_PLY && keep < pos->game_ply) {
+    memmove(pos->reps, pos->reps + pos->game_ply - keep, keep * sizeof(Key));
+    pos->states[keep] = *pos->st;
+    pos->st           = pos->states + keep;
+    pos->game_ply     = keep;
+  }
+}
+
 U64
 attackers_to(const Position *pos, Square sq, U64 occ)
 {
@@ -393,3 +453,26 @@ is_legal(const Position *pos, Move m)
       && !((attacks_bb(  ROOK, ksq, occupancy) &
             enemies & (pos->piece[QUEEN] | pos->piece[  ROOK])));
 }
+
+int
+in_check(const Position *pos)
+{
+  return !!(attackers_to(pos, pos->ksq[pos->turn], ~pos->empty)
+            & pos->color[!pos->turn]);
+}
+
+#ifdef NNUE
+void
+refresh_accumulator(Position *pos)
+{
+  U64 mask;
+  Square sq;
+
+  nnue_reset(&pos->acc[pos->ply]);
+  for (mask = ~pos->empty; mask; ) {
+    sq = pop_lsb(&mask);
+    nnue_add(&pos->acc[pos->ply], pos->board[sq],
+             (pos->color[BLACK] >> sq) & 1 ? BLACK : WHITE, sq);
+  }
+}
+#endif
@@ -4,6 +4,7 @@
 
 #include "bitboards.h"
 #include "chesslib.h"
+#include "nnue.h"
 #include "tt.h"
 
 typedef struct State State;
@@ -12,9 +13,12 @@ struct State {
   int       castle; /* QqKk (bitfield) */
   int       fifty_move_rule;
   PieceType captured;
-  State    *prev;
 };
 
+/* Plies of search below root, tablebase probes may go a few beyond MAX_PLY.
+   Game moves leave this many plies of states free for search. */
+#define MAX_SEARCH_PLY (MAX_PLY + 16)
+
 typedef struct {
   Color     turn;
   U64       color[2];
@@ -28,14 +32,22 @@ typedef struct {
   Key       reps[MAX_GAME_PLY]; /* hash key table for detecting reperitions */
   Key       key;                /* zobrist hash of a position */
   TT       *tt;                 /* transposition table */
-  State    *st;
+  State    *st;                 /* current state, points into states */
+  State     states[MAX_GAME_PLY];
 
   /* killer move <==> quiet move which caused beta cutoff */
   Move killer[2][MAX_PLY]; /* [index][ply] */
   /* history move <==> quiet move that improved alpha */
   Move history[2][6][64];  /* [Color][PieceType][Square] */
+#ifdef NNUE
+  /* accumulators by search ply, updated by do_move, undo_move returns to
+     previous one; last, so that copy_position copies only current one */
+  Accumulator acc[MAX_SEARCH_PLY + 1];
+#endif
 } Position;
 
+extern const int material_score[];
+
 void do_move(Position *pos, Move m);
 void undo_move(Position *pos, Move m);
 void do_null_move(Position *pos);
@@ -43,7 +55,17 @@ void undo_null_move(Position *pos);
 void initialise_zobrist_keys(void);
 void print_position(const Position *pos);
 void set_position(Position *pos, const char *fen);
+void copy_position(Position *dst, const Position *src);
+/* Makes pos root of search, at ply 0. Game moves are played with do_move
+   followed by set_root, which drops plies before last capture or pawn move
+   once states run short. */
+void set_root(Position *pos);
 U64 attackers_to(const Position *pos, Square sq, U64 occ);
 int is_legal(const Position *pos, Move m);
+int in_check(const Position *pos);
+#ifdef NNUE
+/* Computes accumulator of current state from scratch. */
+void refresh_accumulator(Position *pos);
+#endif
 
 #endif /* __POSITION_H__ */
@@ -1,71 +1,172 @@
 /* See LICENSE file for file for copyright and license details */
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-#include <unistd.h>
+#undef INFINITY /* chesslib.h has its own */
 
 #include "chesslib.h"
+#include "egtb.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
 #include "moveorder.h"
 #include "position.h"
 #include "search.h"
+#include "tbprobe.h"
+#include "timeman.h"
+#include "trace.h"
 
-#define ASPIRATION 30
+#define ASPIRATION 15 /* minimal half width of aspiration window */
+#define TB_WIN_VALUE (MATE_VALUE - 2 * MAX_PLY) /* tablebase win at root */
+/* Mates and tablebase wins, which depend on ply and are not evaluations. */
+#define DECISIVE(v)  (abs(v) >= TB_WIN_VALUE - MAX_PLY)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 static inline void listen(void);
-static int quiescence(Position *pos, int alpha, int beta);
-static int negamax(Position *pos, PV *pv, int alpha, int beta, int depth, int cutnode);
+static int quiescence(Thread *th, int alpha, int beta);
+static int negamax(Thread *th, int alpha, int beta, int depth, int cutnode);
+#ifdef TRACE
+/* search nodes, quiescence and negamax record them into trace first */
+static int quiescence_node(Thread *th, int alpha, int beta);
+static int negamax_node(Thread *th, int alpha, int beta, int depth, int cutnode);
+#define TRACE_MOVE(th, m) ((th)->trace_move = (m))
+#else
+#define quiescence_node   quiescence
+#define negamax_node      negamax
+#define TRACE_MOVE(th, m) ((void)0)
+#endif
+static void *iterate(void *arg);
+static void print_info(int depth, int k, int value, Bound bound, const PV *pv);
+#ifdef STATS
+static void sum_stats(Stats *s);
+static void print_stats(int depth);
+static void print_stats_json(void);
+#endif
 static uint64_t perft_help(Position *pos, int depth);
-static inline void print_move(Move m);
 
 SearchInfo info;
+SearchParams params = {
+  .rfp_margin       = 80,
+  .razor_margin     = 250,
+  .futility_margin  = 120,
+  .lmp_base         = 3,
+  .nmp_verify_depth = 12,
+  .iid_depth        = 4,
+  .iid_mode         = IID_REDUCTION,
+  .delta_margin     = 200,
+};
 
-// http://home.arcor.de/dreamlike/chess/
-int input_waiting()
+static Thread *threads;
+static int     nthreads;
+
+static pthread_t searcher; /* thread running search started by search_start */
+static int       searching;
+
+/* nodes of all threads after each iteration of main thread, used for
+   effective branching factor */
+static uint64_t depth_nodes[MAX_PLY + 1];
+static int      last_depth;
+
+/* root moves that keep tablebase result of root, tb_nmoves is 0 if root is
+   not in tablebases, positions of at most tb_limit pieces are probed */
+static Move tb_moves[256];
+static int  tb_nmoves;
+static int  tb_limit;
+static WDL  tb_wdl;
+
+/* late move reductions [depth][number of searched moves] */
+static int reductions[MAX_PLY][64];
+
+/* Helper threads skip some depths of iterative deepening, so that they do not
+   all search the same iteration at once. */
+static const int skip_size[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+static const int skip_phase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+static inline void
+listen(void)
 {
-	struct timeval tv;
-	fd_set readfds;
+  uint64_t nodes = 0;
+
+  if (info.timeset && get_time() > info.stoptime)
+    search_stop();
 
-	FD_ZERO (&readfds);
-	FD_SET (fileno(stdin), &readfds);
-	tv.tv_sec=0; tv.tv_usec=0;
-	select(16, &readfds, 0, 0, &tv);
+  if (info.nodes_limit) {
+    for (int i = 0; i < nthreads; i++)
+      nodes += threads[i].nodes;
+    if (nodes >= info.nodes_limit)
+      search_stop();
+  }
 
-	return (FD_ISSET(fileno(stdin), &readfds));
 }
 
-void read_input() {
-	int bytes;
-	char input[256] = "", *endc;
+/* Counts a node, main thread also checks limits of search once in a while. */
+static inline void
+count_node(Thread *th)
+{
+  if (!(++th->nodes & 4095) && !th->id)
+    listen();
+  if (th->nodes == info.nodes_limit)
+    search_stop();
+}
+
+/* Mate and tablebase values are stored in tt relative to the node, not to
+   the root. */
+static inline int
+value_to_tt(int value, int ply)
+{
+  return !DECISIVE(value) ? value : value > 0 ? value + ply : value - ply;
+}
 
-	if(input_waiting()) {
-		info.stopped = 1;
-		do {
-			bytes=read(fileno(stdin), input, 256);
-		} while (bytes<0);
-		endc = strchr(input, '\n');
-		if (endc)
-			*endc = 0;
+static inline int
+value_from_tt(int value, int ply)
+{
+  return !DECISIVE(value) ? value : value > 0 ? value - ply : value + ply;
+}
 
-		if (strlen(input) > 0) {
-			if (!strncmp(input, "quit", 4))	{
-				info.quit = 1;
-			} else if (!strncmp(input, "stop", 4))
-        info.stopped = 1;
-		}
-		return;
-	}
+/* Value of root as reported. Search of a root in tablebases ranked by dtz
+   does not probe, so its values are evaluations; result of root replaces
+   them unless a mate was found. */
+static inline int
+root_value(int value)
+{
+  if (!tb_nmoves || abs(value) >= MATE_VALUE - MAX_PLY)
+    return value;
+  return tb_wdl > TB_CURSED_WIN ? TB_WIN_VALUE
+       : tb_wdl < TB_BLESSED_LOSS ? -TB_WIN_VALUE : 2 * tb_wdl;
 }
 
+/* Makes pv at ply move m followed by pv of the child. */
 static inline void
-listen(void)
+update_pv(Thread *th, int ply, Move m)
 {
-  if (info.timeset && get_time() > info.stoptime)
-    info.stopped = 1;
-  read_input();
+  th->pv_table[ply][ply] = m;
+  for (int i = ply + 1; i < th->pv_length[ply + 1]; i++)
+    th->pv_table[ply][i] = th->pv_table[ply + 1][i];
+  th->pv_length[ply] = th->pv_length[ply + 1];
+}
+
+/* Returns 1 if root move m is the best move of an earlier multipv line. */
+static inline int
+in_previous_lines(const Thread *th, Move m)
+{
+  for (int k = 0; k < th->pv_index; k++)
+    if (th->lines[k].pv.m[0] == m)
+      return 1;
+  return 0;
+}
+
+/* Returns 1 if root move m loses tablebase result of root. */
+static inline int
+tb_excluded(Move m)
+{
+  if (!tb_nmoves)
+    return 0;
+  for (int i = 0; i < tb_nmoves; i++)
+    if (move_of(tb_moves[i]) == m)
+      return 0;
+  return 1;
 }
 
 static inline int
@@ -78,55 +179,187 @@ is_rep(Position *pos)
   return n >= 3;
 }
 
+#ifdef TRACE
+/* Records node searched by quiescence_node or negamax_node into trace, only
+   main thread is traced. */
 static int
-quiescence(Position *pos, int alpha, int beta)
+trace_node(Thread *th, int alpha, int beta, int depth, int cutnode, int qs)
 {
+  Position *pos = &th->pos;
+  TraceRecord *r = NULL;
+  Move move = th->trace_move;
+  int value;
 
-  int value = evaluate(pos);
-  if (value >= beta)
-    return beta;
-  if (value > alpha)
-    alpha = value;
+  th->trace_move = MOVE_NONE; /* searches of this node from itself have no move */
+  if (!th->id && pos->ply <= trace_max_ply && (r = trace_new())) {
+    r->key   = pos->key;
+    r->alpha = alpha;
+    r->beta  = beta;
+    r->move  = move_of(move);
+    r->level = th->trace_level++;
+    r->ply   = pos->ply;
+    r->depth = depth;
+    r->type  = qs ? NODE_QS : beta - alpha > 1 ? NODE_PV
+             : cutnode ? NODE_CUT : NODE_ALL;
+    r->stage = trace_stage(move);
+  }
+
+  value = qs ? quiescence_node(th, alpha, beta)
+             : negamax_node(th, alpha, beta, depth, cutnode);
+
+  if (r) {
+    r->value = value;
+    th->trace_level--;
+  }
+  th->trace_move = move; /* for researches of the move with another window */
+  return value;
+}
+
+static int
+quiescence(Thread *th, int alpha, int beta)
+{
+  return trace_node(th, alpha, beta, 0, 0, 1);
+}
+
+static int
+negamax(Thread *th, int alpha, int beta, int depth, int cutnode)
+{
+  /* leaves are recorded by quiescence called from negamax_node */
+  if (depth <= 0 && th->pos.ply && !in_check(&th->pos))
+    return negamax_node(th, alpha, beta, depth, cutnode);
+  return trace_node(th, alpha, beta, depth, cutnode, 0);
+}
+#endif
 
+/* Static evaluation of position of thread, looked up in its eval cache
+   first. Values outside of the window may be bounds of lazy evaluation and
+   are not cached. */
+static inline int
+static_eval(Thread *th, int alpha, int beta)
+{
+  Position  *pos = &th->pos;
+  EvalEntry *e   = th->eval_cache + (pos->key & (EVAL_CACHE - 1));
+  int value;
+
+  STAT(th->stats.eval_probes++);
+  if (e->key == (uint32_t)(pos->key >> 32)) {
+    STAT(th->stats.eval_hits++);
+    return e->value;
+  }
+  value = evaluate(pos, alpha, beta);
+  if (value > alpha && value < beta) {
+    e->key   = pos->key >> 32;
+    e->value = value;
+  }
+  return value;
+}
+
+static int
+quiescence_node(Thread *th, int alpha, int beta)
+{
+  Position *pos = &th->pos;
+
+  int value, eval, tt_eval, old_alpha = alpha, tt_hit;
   Move *m, *last, move_list[256];
+  Move move, best_move = MOVE_NONE, hash_move = MOVE_NONE;
+  TTEntry te;
+
+  count_node(th);
+  STAT(th->stats.qnodes++);
+  if (pos->ply > th->seldepth)
+    th->seldepth = pos->ply;
+  if (pos->ply >= MAX_PLY)
+    return static_eval(th, alpha, beta);
+
+  tt_hit = tt_probe(pos->tt, pos->key, &te);
+  STAT(th->stats.tt_probes++);
+  if (tt_hit) {
+    STAT(th->stats.tt_hits++);
+    hash_move = te.move;
+    te.value = value_from_tt(te.value, pos->ply);
+    if ((te.bound == BOUND_EXACT)
+    ||  (te.bound == BOUND_LOWER && te.value >= beta)
+    ||  (te.bound == BOUND_UPPER && te.value <= alpha)) {
+      STAT(th->stats.tt_cutoffs++);
+      return MAX(alpha, MIN(te.value, beta));
+    }
+  }
+
+  /* stand pat, static eval is cached in the tt, only its bound is known if
+     it is below alpha, see evaluate */
+  eval = tt_hit && te.eval != VALUE_NONE ? te.eval : static_eval(th, alpha, beta);
+  tt_eval = eval > alpha || (tt_hit && te.eval != VALUE_NONE) ? eval : VALUE_NONE;
+  if (eval >= beta)
+    return beta;
+  if (eval > alpha)
+    alpha = eval;
 
-  if (!(info.nodes++ & 4095)) listen();
+  /* even winning a queen would not bring value back to alpha */
+  if (eval + material_score[QUEEN] + params.delta_margin <= alpha)
+    return alpha;
 
   last = generate_moves(CAPTURES, move_list, pos);
-  last = process_moves(pos, move_list, last, MOVE_NONE);
+  last = process_moves(pos, move_list, last, hash_move);
 
   sort_moves(move_list, last);
   for (m = move_list; m != last; m++) {
-    do_move(pos, *m);
-    value = -quiescence(pos, -beta, -alpha);
-    undo_move(pos, *m);
+    move = move_of(*m);
 
-    if (info.stopped)
+    /* delta pruning */
+    if (type_of(move) == NORMAL
+    &&  eval + material_score[pos->board[to_sq(move)]] + params.delta_margin <= alpha)
+      continue;
+
+    TRACE_MOVE(th, *m);
+    do_move(pos, move);
+    value = -quiescence(th, -beta, -alpha);
+    undo_move(pos, move);
+
+    if (search_stopped())
       return 0;
 
-    if (value >= beta)
+    if (value >= beta) {
+      tt_store(pos->tt, pos->key, move, value_to_tt(beta, pos->ply), tt_eval,
+               0, BOUND_LOWER);
       return beta;
-    if (value > alpha)
+    }
+    if (value > alpha) {
       alpha = value;
+      best_move = move;
+    }
   }
 
+  tt_store(pos->tt, pos->key, best_move, value_to_tt(alpha, pos->ply), tt_eval, 0,
+           alpha != old_alpha ? BOUND_EXACT : BOUND_UPPER);
+
   return alpha;
 }
 
 static int
-negamax(Position *pos, PV *pv, int alpha, int beta, int depth, int cutnode)
+negamax_node(Thread *th, int alpha, int beta, int depth, int cutnode)
 {
-  PV new_pv;
-  pv->cnt = 0;
+  Position *pos = &th->pos;
+  SearchStack *ss = th->ss + pos->ply;
+  th->pv_length[pos->ply] = pos->ply;
 
   int value      = -INFINITY;
   int best_value = -INFINITY;
   int old_alpha  = alpha;
   int is_root    = pos->ply == 0;
+  int is_pv      = beta - alpha > 1;
+  int moves      = 0; /* number of searched moves */
+  int quiet, gives_check, r, n, ext, singular_beta;
+  int tt_hit, pieces, success;
+  WDL wdl;
+  Bound bound;
+  uint64_t start_nodes = 0;
 
   Move *m, *last, move_list[256];
+  Move move;
   Move best_move = MOVE_NONE;
   Move hash_move = MOVE_NONE;
+  Move excluded  = ss->excluded;
+  TTEntry te;
 
   Square ksq = pos->ksq[pos->turn];
   U64 checkers = attackers_to(pos, ksq, ~pos->empty) & pos->color[!pos->turn];
@@ -134,7 +367,7 @@ negamax(Position *pos, PV *pv, int alpha, int beta, int depth, int cutnode)
 
   if (!is_root) {
     if (pos->ply >= MAX_PLY)
-      return checkers ? 0 : evaluate(pos);
+      return checkers ? 0 : static_eval(th, alpha, beta);
 
     /* 50 moves with no pawn move / capture or 3fold repetition */
     if (pos->st->fifty_move_rule >= 100 || is_rep(pos))
@@ -143,24 +376,132 @@ negamax(Position *pos, PV *pv, int alpha, int beta, int depth, int cutnode)
     /* dont end search if in check */
     if (depth <= 0) {
       if (!checkers)
-        return quiescence(pos, alpha, beta);
+        return quiescence(th, alpha, beta);
       depth = 1;
     }
   }
 
-  if (!(info.nodes++ & 4095)) listen();
+  count_node(th);
+  if (pos->ply > th->seldepth)
+    th->seldepth = pos->ply;
+
+  /* transposition table cutoff, not in pv and singular verification nodes */
+  tt_hit = !excluded && tt_probe(pos->tt, pos->key, &te);
+  STAT(th->stats.tt_probes += !excluded);
+  if (tt_hit) {
+    STAT(th->stats.tt_hits++);
+    hash_move = te.move;
+    te.value = value_from_tt(te.value, pos->ply);
+    if (!is_pv && te.depth >= depth
+    && ((te.bound == BOUND_EXACT)
+    ||  (te.bound == BOUND_LOWER && te.value >= beta)
+    ||  (te.bound == BOUND_UPPER && te.value <= alpha))) {
+      STAT(th->stats.tt_cutoffs++);
+      return MAX(alpha, MIN(te.value, beta));
+    }
+  }
 
-  /* null move prunning */
-  if (cutnode && !is_root && !checkers && depth >= 4 
-  && ((pos->piece[QUEEN] | pos->piece[ROOK]) & pos->color[pos->turn])) {
-    do_null_move(pos);
-    value = -negamax(pos, &new_pv, -beta, -beta + 1, depth - 4, 0);
-    undo_null_move(pos);
-    if (value >= beta)
+  /* own tables are exact, they are probed at any depth; they ignore fifty
+     move rule, so mates it may reach first are left to search */
+  if (egtb_largest && !is_root && !excluded
+  &&  popcount(~pos->empty) <= egtb_largest && egtb_probe(pos, &value)
+  &&  (!value || pos->st->fifty_move_rule + MATE_VALUE - abs(value) <= 100)) {
+    th->tbhits++;
+    value = value > 0 ? value - pos->ply : value < 0 ? value + pos->ply : 0;
+    tt_store(pos->tt, pos->key, MOVE_NONE, value_to_tt(value, pos->ply),
+             VALUE_NONE, MAX_PLY - 1, BOUND_EXACT);
+    return MAX(alpha, MIN(value, beta));
+  }
+
+  /* tablebase probe, positions of largest tables only at some depth */
+  if (tb_limit && !is_root && !excluded
+  &&  (pieces = popcount(~pos->empty)) <= tb_limit
+  &&  (pieces < tb_limit || depth >= tb_probe_depth)
+  &&  !pos->st->fifty_move_rule && !pos->st->castle) {
+    wdl = tb_probe_wdl(pos, &success);
+    if (success) {
+      th->tbhits++;
+      value = wdl < TB_BLESSED_LOSS ? pos->ply - TB_WIN_VALUE
+            : wdl > TB_CURSED_WIN ? TB_WIN_VALUE - pos->ply : 2 * wdl;
+      bound = wdl < TB_BLESSED_LOSS ? BOUND_UPPER
+            : wdl > TB_CURSED_WIN ? BOUND_LOWER : BOUND_EXACT;
+      if (bound == BOUND_EXACT
+      ||  (bound == BOUND_LOWER && value >= beta)
+      ||  (bound == BOUND_UPPER && value <= alpha)) {
+        tt_store(pos->tt, pos->key, MOVE_NONE, value_to_tt(value, pos->ply),
+                 VALUE_NONE, MIN(depth + 6, MAX_PLY - 1), bound);
+        return MAX(alpha, MIN(value, beta));
+      }
+    }
+  }
+
+  ss->move = MOVE_NONE;
+  ss->static_eval = checkers ? VALUE_NONE
+                  : tt_hit && te.eval != VALUE_NONE ? te.eval : static_eval(th, -INFINITY, INFINITY);
+  ss->improving = pos->ply >= 2 && !checkers
+               && (ss - 2)->static_eval != VALUE_NONE
+               && ss->static_eval > (ss - 2)->static_eval;
+
+  if (!is_pv && !checkers && !excluded) {
+    /* reverse futility pruning */
+    if (depth <= 8
+    &&  ss->static_eval - params.rfp_margin * (depth - ss->improving) >= beta)
       return beta;
+
+    /* razoring */
+    if (depth <= 3 && ss->static_eval + params.razor_margin * depth <= alpha) {
+      value = quiescence(th, alpha, alpha + 1);
+      if (value <= alpha)
+        return alpha;
+    }
+
+    /* null move prunning */
+    if (depth >= 3 && ss->static_eval >= beta && pos->ply >= th->nmp_min_ply
+    && (ss - 1)->move != MOVE_NULL
+    && ((pos->piece[QUEEN] | pos->piece[ROOK]) & pos->color[pos->turn])) {
+      r = 3 + depth / 4 + MIN((ss->static_eval - beta) / 200, 3);
+      STAT(th->stats.nmp_tries++);
+      ss->move = MOVE_NULL;
+      TRACE_MOVE(th, MOVE_NULL);
+      do_null_move(pos);
+      value = -negamax(th, -beta, -beta + 1, depth - 1 - r, !cutnode);
+      undo_null_move(pos);
+      if (search_stopped())
+        return 0;
+
+      if (value >= beta) {
+        if (depth < params.nmp_verify_depth) {
+          STAT(th->stats.nmp_cutoffs++);
+          return beta;
+        }
+
+        /* verify at high depth with null moves disabled for a few plies */
+        th->nmp_min_ply = pos->ply + 3 * (depth - 1 - r) / 4;
+        value = negamax(th, beta - 1, beta, depth - 1 - r, 0);
+        th->nmp_min_ply = 0;
+        if (value >= beta) {
+          STAT(th->stats.nmp_cutoffs++);
+          return beta;
+        }
+      }
+    }
+  }
+
+  /* without hash move, either find one by a shallower search (iid)
+     or just search less, as the node is probably not important (iir) */
+  if (!hash_move && !excluded && (is_pv || cutnode)
+  &&  params.iid_depth && depth >= params.iid_depth) {
+    if (params.iid_mode == IID_DEEPENING) {
+      negamax(th, alpha, beta, depth - 2, cutnode);
+      if (search_stopped())
+        return 0;
+      if ((tt_hit = tt_probe(pos->tt, pos->key, &te)))
+        hash_move = te.move;
+    } else {
+      depth--;
+    }
   }
 
-  hash_move = tt_probe(pos->tt, pos->key);
   last = generate_moves(ALL, move_list, pos);
   last = process_moves(pos, move_list, last, hash_move);
 
@@ -168,93 +509,524 @@ negamax(Position *pos, PV *pv, int alpha, int beta, int depth, int cutnode)
   if (move_list == last)
     return checkers ? pos->ply - MATE_VALUE : 0;
 
+  /* searches above might have left their pv at this ply */
+  th->pv_length[pos->ply] = pos->ply;
+
   sort_moves(move_list, last);
   for (m = move_list; m != last; m++) {
-    do_move(pos, *m);
+    move = move_of(*m);
+    if (move == excluded
+    || (is_root && (in_previous_lines(th, move) || tb_excluded(move))))
+      continue;
+    n = m - move_list + 1;
+    quiet = pos->board[to_sq(move)] == NONE && type_of(move) == NORMAL;
 
-    value = -negamax(pos, &new_pv, -beta, -alpha, depth - 1, 1);
+    /* late move pruning */
+    if (!is_pv && !checkers && quiet && moves && depth <= 8
+    &&  n > (params.lmp_base + depth * depth) / (2 - ss->improving))
+      continue;
 
-    undo_move(pos, *m);
+    /* singular extension - extend the hash move if all other moves are
+       clearly worse, cut if more than one move beats beta (multi-cut) */
+    ext = 0;
+    if (move == hash_move && tt_hit && !is_root && depth >= 8 && !excluded
+    &&  (te.bound & BOUND_LOWER) && te.depth >= depth - 3
+    &&  !DECISIVE(te.value)) {
+      singular_beta = te.value - 2 * depth;
+      ss->excluded = move;
+      value = negamax(th, singular_beta - 1, singular_beta, (depth - 1) / 2, cutnode);
+      ss->excluded = MOVE_NONE;
+      th->pv_length[pos->ply] = pos->ply;
+      if (search_stopped())
+        return 0;
+      if (value < singular_beta)
+        ext = 1;
+      else if (singular_beta >= beta)
+        return beta;
+    }
+
+    ss->move = move;
+    start_nodes = th->nodes;
+    TRACE_MOVE(th, *m);
+    do_move(pos, move);
+    gives_check = in_check(pos);
+
+    /* check extension, limited so that checks cannot explode the search */
+    if (gives_check && pos->ply < 2 * th->root_depth)
+      ext = 1;
+
+    /* futility pruning */
+    if (!is_pv && !checkers && quiet && moves && !gives_check && depth <= 6
+    &&  ss->static_eval + params.futility_margin * depth <= alpha) {
+      undo_move(pos, move);
+      continue;
+    }
+
+    moves++;
+
+    if (moves == 1) {
+      value = -negamax(th, -beta, -alpha, depth - 1 + ext, is_pv ? 0 : !cutnode);
+    } else {
+      /* late move reductions */
+      r = 0;
+      if (depth >= 3 && quiet && moves > 1 + 2 * is_pv) {
+        r = reductions[MIN(depth, MAX_PLY - 1)][MIN(moves, 63)];
+        r += !is_pv + cutnode - gives_check;
+        r -= pos->history[!pos->turn][pos->board[to_sq(move)]][to_sq(move)] / 512;
+        r = MAX(0, MIN(r, depth - 2));
+      }
+
+      /* principal variation search - zero window, then re-search */
+      value = -negamax(th, -alpha - 1, -alpha, depth - 1 + ext - r, 1);
+      if (value > alpha && r)
+        value = -negamax(th, -alpha - 1, -alpha, depth - 1 + ext, !cutnode);
+      if (value > alpha && value < beta)
+        value = -negamax(th, -beta, -alpha, depth - 1 + ext, 0);
+    }
+
+    undo_move(pos, move);
   
-    if (info.stopped)
+    if (search_stopped())
       return 0;
 
     if (value >= beta) {
-      if (pos->board[to_sq(*m)] == NONE) { /* found killer */
+      STAT(th->stats.cutoffs++);
+      STAT(th->stats.first_move_cutoffs += moves == 1);
+      if (pos->board[to_sq(move)] == NONE) { /* found killer */
         pos->killer[1][pos->ply] = pos->killer[0][pos->ply];
-        pos->killer[0][pos->ply] = *m;
+        pos->killer[0][pos->ply] = move;
+      }
+      if (!excluded)
+        tt_store(pos->tt, pos->key, move, value_to_tt(beta, pos->ply),
+                 ss->static_eval, depth, BOUND_LOWER);
+      if (is_root) { /* report the move which failed high */
+        if (!th->pv_index)
+          th->best_nodes = th->nodes - start_nodes;
+        update_pv(th, pos->ply, move);
       }
       return beta;
     }
     if (value > alpha) {
-      pv->m[0] = *m;
-      pv->cnt = new_pv.cnt + 1;
-
-      memcpy(pv->m + 1, new_pv.m, new_pv.cnt * sizeof(Move));
+      update_pv(th, pos->ply, move);
       alpha = value;
       best_value = value;
-      best_move = *m;
+      best_move = move;
+      if (is_root && !th->pv_index)
+        th->best_nodes = th->nodes - start_nodes;
 
-      if (pos->board[to_sq(*m)] == NONE) {
-        pos->history[pos->turn][pos->board[from_sq(*m)]][to_sq(*m)] += depth;
+      if (pos->board[to_sq(move)] == NONE) {
+        pos->history[pos->turn][pos->board[from_sq(move)]][to_sq(move)] += depth;
       }
     }
   }
 
-  if (alpha != old_alpha)
-    tt_store(pos->tt, pos->key, best_move);
+  if (!excluded)
+    tt_store(pos->tt, pos->key, best_move, value_to_tt(alpha, pos->ply),
+             ss->static_eval, depth,
+             alpha != old_alpha ? BOUND_EXACT : BOUND_UPPER);
 
   return alpha;
 }
 
-void
-search(Position *pos)
+/* Iterative deepening loop of a single thread. */
+static void *
+iterate(void *arg)
 {
-  int value;
-  int alpha = -INFINITY, beta = INFINITY;
+  Thread *th = arg;
+  Position *pos = &th->pos;
+  Line *line, tmp;
+  int value = 0, i = (th->id - 1) % 20, k;
+  int alpha, beta, delta_low, delta_high;
+  int volatility = 0; /* average change of value between iterations */
+  int stability  = 0; /* iterations without change of best move */
+  int stop;
+  uint64_t iteration_nodes;
   PV pv;
-  Move bestmove = MOVE_NONE;
 
-  pos->ply = 0;
-  tt_clear(pos->tt);
+  for (int depth = 1; depth <= info.depth; depth++) {
+    if (th->id && ((depth + pos->game_ply + skip_phase[i]) / skip_size[i]) % 2)
+      continue;
 
-  info.stopped = 0;
-  info.nodes = 0;
+    th->root_depth = depth;
+    th->best_nodes = 0;
+    iteration_nodes = th->nodes;
 
-  memset(pos->killer, MOVE_NONE, sizeof(pos->killer));
-  memset(pos->history, 0, sizeof(pos->history));
+    /* each multipv line is searched without best moves of previous ones */
+    for (th->pv_index = 0; th->pv_index < th->multipv; th->pv_index++) {
+      line = th->lines + th->pv_index;
 
-  for (int depth = 1; depth <= info.depth; depth++, info.nodes = 0) {
-    value = negamax(pos, &pv, alpha, beta, depth, 0);
-    if (value <= alpha || value >= beta) {
+      /* aspiration window around value of previous iteration */
       alpha = -INFINITY;
       beta  =  INFINITY;
-      depth--;
-      continue;
+      delta_low = delta_high = ASPIRATION + volatility;
+      if (th->depth >= 4 && !DECISIVE(line->value)) {
+        alpha = MAX(line->value - delta_low,  -INFINITY);
+        beta  = MIN(line->value + delta_high,  INFINITY);
+      }
+
+      for (;;) {
+        value = negamax(th, alpha, beta, depth, 0);
+        pv.cnt = th->pv_length[0];
+        memcpy(pv.m, th->pv_table[0], pv.cnt * sizeof(Move));
+
+        if (search_stopped())
+          break;
+
+        /* widen only the side of the window that failed */
+        if (value <= alpha) {
+          if (!th->id && th->multipv == 1)
+            print_info(depth, 1, value, BOUND_UPPER, &th->pv);
+          delta_low += delta_low / 2;
+          alpha = MAX(value - delta_low, -INFINITY);
+        } else if (value >= beta) {
+          if (!th->id && th->multipv == 1)
+            print_info(depth, 1, value, BOUND_LOWER, &pv);
+          delta_high += delta_high / 2;
+          beta = MIN(value + delta_high, INFINITY);
+        } else {
+          break;
+        }
+      }
+
+      if (search_stopped())
+        break;
+
+      line->value = value;
+      line->pv    = pv;
+    }
+
+    if (search_stopped())
+      break;
+
+    /* later lines may still turn out better than earlier ones */
+    for (k = 1; k < th->multipv; k++) {
+      tmp = th->lines[k];
+      for (line = th->lines + k; line > th->lines && (line - 1)->value < tmp.value; line--)
+        *line = *(line - 1);
+      *line = tmp;
+    }
+    value = th->lines[0].value;
+    pv    = th->lines[0].pv;
+
+    if (th->depth) {
+      volatility = (volatility + abs(value - th->value)) / 2;
+      stability = pv.m[0] == th->pv.m[0] ? stability + 1 : 0;
     }
+    iteration_nodes = th->nodes - iteration_nodes;
 
-    if (depth > 4) {
-      alpha = value - ASPIRATION;
-      beta  = value + ASPIRATION;
+    if (!th->id) {
+      for (k = 0; k < th->multipv; k++)
+        print_info(depth, k + 1, th->lines[k].value, BOUND_EXACT, &th->lines[k].pv);
+      depth_nodes[depth] = info.nodes;
+      last_depth = depth;
+#ifdef STATS
+      print_stats(depth);
+#endif
     }
 
-    if (info.stopped)
+    /* main thread decides whether there is time for next iteration */
+    stop = !th->id
+        && ((info.mate && value >= MATE_VALUE - 2 * info.mate + 1)
+        ||  time_stop_iteration(stability, th->depth ? th->value - value : 0,
+                                (double)th->best_nodes / MAX(iteration_nodes, 1)));
+
+    th->depth = depth;
+    th->value = value;
+    th->pv    = pv;
+
+    if (stop)
       break;
+  }
+
+  return NULL;
+}
+
+static void
+print_info(int depth, int k, int value, Bound bound, const PV *pv)
+{
+  int seldepth = 0, time = MAX(get_time() - info.starttime, 1);
+  uint64_t tbhits = 0;
+
+  info.nodes = 0;
+  for (int i = 0; i < nthreads; i++) {
+    info.nodes += threads[i].nodes;
+    tbhits += threads[i].tbhits;
+    seldepth = MAX(seldepth, threads[i].seldepth);
+  }
+  if (info.silent)
+    return;
+
+  /* tablebase wins are reported as centipawns close to mate values */
+  value = root_value(value);
+  flockfile(stdout);
+  printf("info depth %d seldepth %d ", depth, seldepth);
+  if (info.multipv > 1)
+    printf("multipv %d ", k);
+  printf("score ");
+  if (value >= MATE_VALUE - MAX_PLY)
+    printf("mate %d", (MATE_VALUE - value + 1) / 2);
+  else if (value <= -MATE_VALUE + MAX_PLY)
+    printf("mate %d", -(MATE_VALUE + value) / 2);
+  else
+    printf("cp %d", value);
+  printf("%s nodes %lu time %d nps %lu tbhits %lu pv",
+         bound == BOUND_LOWER ? " lowerbound"
+       : bound == BOUND_UPPER ? " upperbound" : "",
+         info.nodes, time, info.nodes * 1000 / time, tbhits);
+  for (int i = 0; i < pv->cnt; i++) {
+    printf(" ");
+    print_move(pv->m[i]);
+  }
+  printf("\n");
+  funlockfile(stdout);
+}
+
+#ifdef STATS
+static void
+sum_stats(Stats *s)
+{
+  memset(s, 0, sizeof(*s));
+  for (int i = 0; i < nthreads; i++) {
+    s->qnodes             += threads[i].stats.qnodes;
+    s->tt_probes          += threads[i].stats.tt_probes;
+    s->tt_hits            += threads[i].stats.tt_hits;
+    s->tt_cutoffs         += threads[i].stats.tt_cutoffs;
+    s->nmp_tries          += threads[i].stats.nmp_tries;
+    s->nmp_cutoffs        += threads[i].stats.nmp_cutoffs;
+    s->cutoffs            += threads[i].stats.cutoffs;
+    s->first_move_cutoffs += threads[i].stats.first_move_cutoffs;
+    s->eval_probes        += threads[i].stats.eval_probes;
+    s->eval_hits          += threads[i].stats.eval_hits;
+  }
+}
+
+/* Ratio of counters in percent. */
+static double
+pct(uint64_t a, uint64_t b)
+{
+  return b ? 100.0 * a / b : 0.0;
+}
+
+/* Effective branching factor of iteration at depth. */
+static double
+ebf(int depth)
+{
+  return depth > 1 && depth_nodes[depth - 1]
+    ? (double)depth_nodes[depth] / depth_nodes[depth - 1] : 0.0;
+}
+
+/* Prints counters after iteration of main thread as uci info string. */
+static void
+print_stats(int depth)
+{
+  Stats s;
+
+  if (info.silent)
+    return;
+  sum_stats(&s);
+  flockfile(stdout);
+  printf("info string qnodes %.1f%% tthits %.1f%% ttcuts %.1f%% "
+         "nullcuts %.1f%% firstcuts %.1f%% evalhits %.1f%% ebf %.2f\n",
+         pct(s.qnodes, info.nodes), pct(s.tt_hits, s.tt_probes),
+         pct(s.tt_cutoffs, s.tt_probes), pct(s.nmp_cutoffs, s.nmp_tries),
+         pct(s.first_move_cutoffs, s.cutoffs), pct(s.eval_hits, s.eval_probes),
+         ebf(depth));
+  funlockfile(stdout);
+}
+
+/* Prints statistics of whole search as json on single info string line. */
+static void
+print_stats_json(void)
+{
+  Stats s;
+  int seldepth = 0, time = MAX(get_time() - info.starttime, 1);
+
+  sum_stats(&s);
+  for (int i = 0; i < nthreads; i++)
+    seldepth = MAX(seldepth, threads[i].seldepth);
 
-    printf("info depth %d score cp %d nodes %lu pv",
-           depth, value, info.nodes);
+  flockfile(stdout);
+  printf("info string stats {\"depth\": %d, \"seldepth\": %d, "
+         "\"nodes\": %lu, \"time\": %d, \"nps\": %lu, ",
+         last_depth, seldepth, info.nodes, time, info.nodes * 1000 / time);
+  printf("\"qnodes\": %lu, \"tt_probes\": %lu, \"tt_hits\": %lu, "
+         "\"tt_cutoffs\": %lu, \"nmp_tries\": %lu, \"nmp_cutoffs\": %lu, "
+         "\"cutoffs\": %lu, \"first_move_cutoffs\": %lu, "
+         "\"eval_probes\": %lu, \"eval_hits\": %lu, \"ebf\": [",
+         s.qnodes, s.tt_probes, s.tt_hits, s.tt_cutoffs, s.nmp_tries,
+         s.nmp_cutoffs, s.cutoffs, s.first_move_cutoffs, s.eval_probes,
+         s.eval_hits);
+  for (int d = 2; d <= last_depth; d++)
+    printf("%s%.2f", d > 2 ? ", " : "", ebf(d));
+  printf("]}\n");
+  funlockfile(stdout);
+}
+#endif
+
+void
+search(Position *pos)
+{
+  Thread *th, *best;
+  Move history[2][6][64];
+  int nmoves, dtz;
 
-    bestmove = pv.m[0];
-    for (int i = 0; i < pv.cnt; i++) {
-      printf(" ");
-      print_move(pv.m[i]);
+  if (nthreads != info.threads) {
+    delete_threads();
+    if (!(threads = calloc(info.threads, sizeof(Thread)))) {
+      printf("info string cannot allocate %d threads\n", info.threads);
+      return;
     }
-    printf("\n");
+    nthreads = info.threads;
+  }
+
+  set_root(pos);
+  tt_new_search(pos->tt);
+#ifdef TRACE
+  trace_start();
+#endif
+
+  /* play the only legal move instantly */
+  Move move_list[256], *last;
+  last = generate_moves(ALL, move_list, pos);
+  last = process_moves(pos, move_list, last, MOVE_NONE);
+  nmoves = last - move_list;
+
+  /* root in tablebases - search only moves keeping its result, probe in
+     search only if it is won and dtz tables could not tell how to win */
+  tb_limit = tb_largest;
+  memcpy(tb_moves, move_list, nmoves * sizeof(Move));
+  if ((tb_nmoves = tb_root_moves(pos, tb_moves, nmoves, &dtz, &tb_wdl))) {
+    nmoves = tb_nmoves;
+    if (dtz || tb_wdl <= TB_DRAW)
+      tb_limit = 0;
   }
 
+  if (info.timeset && nmoves == 1)
+    info.depth = 1;
+
+  info.nodes = 0;
+
+  for (th = threads; th < threads + nthreads; th++) {
+    /* histories of previous search still order moves, but they fade, so
+       that new ones take over; killers are of plies of previous search */
+    memcpy(history, th->pos.history, sizeof(history));
+    copy_position(&th->pos, pos);
+    memset(th->pos.killer, MOVE_NONE, sizeof(th->pos.killer));
+    for (int i = 0; i < 2 * 6 * 64; i++)
+      (&th->pos.history[0][0][0])[i] = (&history[0][0][0])[i] / 2;
+    th->id     = th - threads;
+    th->depth  = 0;
+    th->value  = -INFINITY;
+    th->nodes  = 0;
+    th->tbhits = 0;
+    th->seldepth = 0;
+    th->pv.cnt = 0;
+    th->nmp_min_ply = 0;
+    th->multipv = MAX(1, MIN(info.multipv, nmoves));
+#ifdef TRACE
+    th->trace_move  = MOVE_NONE;
+    th->trace_level = 0;
+#endif
+    memset(th->ss, 0, sizeof(th->ss));
+    memset(th->lines, 0, sizeof(th->lines));
+    memset(&th->stats, 0, sizeof(th->stats));
+  }
+  last_depth = 0;
+
+  /* helpers search in the background, main thread searches in this one */
+  for (th = threads + 1; th < threads + nthreads; th++)
+    pthread_create(&th->handle, NULL, iterate, th);
+  iterate(threads);
+
+  search_stop();
+  for (th = threads + 1; th < threads + nthreads; th++)
+    pthread_join(th->handle, NULL);
+
+  /* helpers may have searched after last report of main thread */
+  info.nodes = 0;
+  for (th = threads; th < threads + nthreads; th++)
+    info.nodes += th->nodes;
+
+  /* helper wins only if it completed a deeper iteration with better value,
+     multipv lines are always reported by the main thread */
+  best = threads;
+  for (th = threads + 1; th < threads + nthreads && info.multipv == 1; th++)
+    if (th->depth > best->depth && th->value > best->value)
+      best = th;
+
+  if (best != threads)
+    print_info(best->depth, 1, best->value, BOUND_EXACT, &best->pv);
+#ifdef STATS
+  print_stats_json();
+#endif
+#ifdef TRACE
+  trace_write();
+#endif
+
+  /* search stopped before first iteration, any legal move is better than none */
+  info.best_move  = best->pv.cnt ? best->pv.m[0]
+                  : tb_nmoves ? move_of(tb_moves[0])
+                  : last != move_list ? move_of(move_list[0]) : MOVE_NONE;
+  info.best_value = best->depth ? root_value(best->value) : 0;
+  if (info.silent)
+    return;
+
+  flockfile(stdout);
   printf("bestmove ");
-  print_move(bestmove);
+  print_move(info.best_move);
   printf("\n");
+  funlockfile(stdout);
+}
+
+void
+search_clear(Position *pos)
+{
+  for (int i = 0; i < nthreads; i++) {
+    memset(threads[i].pos.history, 0, sizeof(threads[i].pos.history));
+    memset(threads[i].eval_cache, 0, sizeof(threads[i].eval_cache));
+  }
+  tt_clear(pos->tt);
+}
+
+void
+initialise_search(void)
+{
+  for (int d = 1; d < MAX_PLY; d++)
+    for (int n = 1; n < 64; n++)
+      reductions[d][n] = 0.75 + log(d) * log(n) / 2.25;
+}
+
+static void *
+search_thread(void *pos)
+{
+  search(pos);
+  return NULL;
+}
+
+void
+search_start(Position *pos)
+{
+  search_wait();
+  __atomic_store_n(&info.stopped, 0, __ATOMIC_RELAXED);
+  searching = 1;
+  pthread_create(&searcher, NULL, search_thread, pos);
+}
+
+void
+search_wait(void)
+{
+  if (searching) {
+    pthread_join(searcher, NULL);
+    searching = 0;
+  }
+}
+
+void
+delete_threads(void)
+{
+  free(threads);
+  threads  = NULL;
+  nthreads = 0;
 }
 
 static U64
@@ -297,7 +1069,7 @@ perft(Position *pos)
   printf("\nNodes searched: %lu (%dms)\n\n", nodes_searched, get_time() - t);
 }
 
-static inline void
+void
 print_move(Move m)
 {
   static const char *pc_to_str[] = { "p", "n", "b", "r", "q", "k" };
@@ -316,6 +1088,6 @@ print_move(Move m)
 
   printf("%s%s%s", t[from_sq(m)],t[to_sq(m)],
                    type_of(m) == PROMOTION ?
-                   pc_to_str[KNIGHT + promotion_type(m)] : "");
+                   pc_to_str[promotion_type(m)] : "");
 }
 
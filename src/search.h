@@ -2,33 +2,169 @@
 #ifndef __SEARCH_H__
 #define __SEARCH_H__
 
+#include <pthread.h>
+
 #include "chesslib.h"
 #include "position.h"
 
+#define MAX_THREADS 256
+#define MAX_MULTIPV 64
+#define EVAL_CACHE  16384 /* entries of eval cache of each thread, power of 2 */
+
+/* Search statistics are counted only when compiled with -DSTATS. */
+#ifdef STATS
+#define STAT(x) (x)
+#else
+#define STAT(x) ((void)0)
+#endif
+
 typedef struct {
   int  cnt;
   Move m[MAX_PLY];
 } PV;
 
+/* Line found for one of multipv slots. */
+typedef struct {
+  int value;
+  PV  pv;
+} Line;
+
 typedef struct {
   int starttime;
-  int stoptime;
+  int stoptime; /* hard limit, search is aborted after it */
+  int softtime; /* ms after which no new iteration should start */
 
   int depth;
   int depthset;
   int timeset;
+  int mate;     /* search for mate in that many moves, 0 if not set */
+
+  uint64_t nodes_limit; /* 0 if not set */
 
   int movestogo;
 
+  int threads; /* number of search threads */
+  int multipv; /* number of best lines to find */
+
+  int silent;  /* do not print info and bestmove */
   int quit;    /* flag for quitting program */
-  int stopped; /* flag for stopping search */
+  int stopped; /* flag for stopping search, accessed atomically */
+
+  uint64_t nodes; /* nodes visited during search (all threads) */
 
-  uint64_t nodes; /* nodes visited during search */
+  Move best_move;  /* result of last search */
+  int  best_value;
 } SearchInfo;
 
-extern SearchInfo info;
+typedef enum {
+  IID_REDUCTION, /* reduce depth of nodes without hash move */
+  IID_DEEPENING, /* search them shallower first to find hash move */
+} IIDMode;
+
+/* Tunable search parameters, exposed as uci options. */
+typedef struct {
+  int rfp_margin;       /* reverse futility margin per ply of depth */
+  int razor_margin;     /* razoring margin per ply of depth */
+  int futility_margin;  /* futility margin per ply of depth */
+  int lmp_base;         /* base of quiet move count for late move pruning */
+  int nmp_verify_depth; /* min depth for verification of null move cutoff */
+  int iid_depth;        /* min depth of iid / iir, 0 disables it */
+  int iid_mode;         /* IIDMode */
+  int delta_margin;     /* delta pruning margin in quiescence */
+} SearchParams;
+
+/* Counters of search events, summed over threads when reported. */
+typedef struct {
+  uint64_t qnodes;             /* nodes visited in quiescence */
+  uint64_t tt_probes;
+  uint64_t tt_hits;
+  uint64_t tt_cutoffs;
+  uint64_t nmp_tries;          /* null move searches */
+  uint64_t nmp_cutoffs;        /* null move searches that failed high */
+  uint64_t cutoffs;            /* beta cutoffs in main search */
+  uint64_t first_move_cutoffs; /* beta cutoffs by the first move searched */
+  uint64_t eval_probes;        /* static evaluations asked for */
+  uint64_t eval_hits;          /* of them found in eval cache */
+} Stats;
+
+/* Static evaluation of a position, low bits of key select the entry. */
+typedef struct {
+  uint32_t key; /* high bits of zobrist key */
+  int32_t  value;
+} EvalEntry;
+
+/* Data of a search thread kept for each ply. */
+typedef struct {
+  Move move;        /* move being searched at this ply */
+  Move excluded;    /* move skipped by singular extension search */
+  int  static_eval;
+  int  improving;   /* static eval is better than 2 plies ago */
+} SearchStack;
+
+/* Data owned by a single search thread. */
+typedef struct {
+  int       id;
+  pthread_t handle;
+  Position  pos;   /* private copy of the searched position */
+  PV        pv;    /* pv of the last completed iteration */
+  int       depth; /* last completed depth */
+  int       root_depth; /* depth of the current iteration */
+  int       value; /* value of the last completed iteration */
+  uint64_t  nodes; /* nodes visited by this thread */
+  uint64_t  tbhits; /* successful tablebase probes */
+  uint64_t  best_nodes; /* nodes spent on best root move in this iteration */
+  int       seldepth; /* max ply reached */
+  Stats     stats;
+
+  Line      lines[MAX_MULTIPV]; /* lines of current iteration, best first */
+  int       multipv;  /* number of lines searched by this thread */
+  int       pv_index; /* line being searched */
+
+  SearchStack ss[MAX_PLY + 1];
+  /* triangular pv table, row ply holds pv from ply on */
+  Move        pv_table[MAX_PLY + 1][MAX_PLY + 1];
+  int         pv_length[MAX_PLY + 1];
+  int         nmp_min_ply; /* null move is disabled below this ply */
+  EvalEntry   eval_cache[EVAL_CACHE];
+#ifdef TRACE
+  Move        trace_move;  /* scored move leading to next searched node */
+  int         trace_level; /* number of open records */
+#endif
+} Thread;
+
+extern SearchInfo   info;
+extern SearchParams params;
 
+void initialise_search(void);
 void perft(Position *pos);
+/* Searches pos and prints bestmove, blocks until search is finished. */
 void search(Position *pos);
+/* Starts search of pos in background, pos must not change until it ends. */
+void search_start(Position *pos);
+/* Waits for background search to finish. */
+void search_wait(void);
+/* Forgets what previous searches learned, histories and eval caches of
+   threads and table of pos. Searches of one game build on each other
+   otherwise, so it has to be called when evaluation changes. */
+void search_clear(Position *pos);
+/* Prints m in uci notation. */
+void print_move(Move m);
+
+/* Stop flag is polled at every node by all threads, relaxed atomics are
+   enough for that and they cost nothing on the hot path. */
+static inline int
+search_stopped(void)
+{
+  return __atomic_load_n(&info.stopped, __ATOMIC_RELAXED);
+}
+
+static inline void
+search_stop(void)
+{
+  __atomic_store_n(&info.stopped, 1, __ATOMIC_RELAXED);
+}
+
+/* Frees memory used by search threads. */
+void delete_threads(void);
 
 #endif /* __SEARCH_H__ */
@@ -0,0 +1,1017 @@
+/* See LICENSE file for file for copyright and license details */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitboards.h"
+#include "chesslib.h"
+#include "movegen.h"
+#include "moveorder.h"
+#include "position.h"
+#include "tbprobe.h"
+
+/*
+ * Probing of syzygy tables, following the format of their generator and the
+ * probing code of Stockfish. Squares are numbered from a1 as in the tables,
+ * pieces are coded as PieceType + 1, with 8 added for black.
+ */
+
+#define TB_HASH_BITS 13 /* 8192 slots, twice the keys of 7 piece tables */
+#define TB_HASH      (1 << TB_HASH_BITS)
+#define MAX_DTZ (1 << 18)
+
+/* Flags of PairsData. */
+enum {
+  TB_STM          = 1,   /* dtz table stores black to move */
+  TB_MAPPED       = 2,   /* dtz values are mapped through dtz_map */
+  TB_WIN_PLIES    = 4,   /* dtz of wins is in plies, not moves */
+  TB_LOSS_PLIES   = 8,
+  TB_WIDE         = 16,  /* dtz_map has 16 bit values */
+  TB_SINGLE_VALUE = 128, /* all positions have the same value */
+};
+
+/* Result of a probe besides its value. */
+enum {
+  PROBE_FAIL,
+  PROBE_OK,
+  PROBE_CHANGE_STM, /* dtz table stores only the other side to move */
+  PROBE_ZEROING,    /* best move is a capture or pawn move */
+};
+
+/* Compressed values of one side to move and file of leading pawn of a table.
+   Values are canonical huffman codes of symbols, which expand by recursive
+   pairing into sequences of values. */
+typedef struct {
+  uint8_t        flags;
+  uint8_t        max_sym_len;
+  uint8_t        min_sym_len; /* value of single value tables */
+  uint8_t        pieces[TB_PIECES]; /* order of pieces in index */
+  int            group_len[TB_PIECES + 1]; /* zero terminated */
+  uint64_t       group_idx[TB_PIECES + 1]; /* multiplier of each group */
+  uint64_t       block_size;
+  uint64_t       span;   /* values between entries of sparse index */
+  uint64_t       nblocks;
+  const uint8_t *lowest_sym;   /* 16 bit lowest symbol of each length */
+  const uint8_t *btree;        /* 12 bit left and right symbol of pairs */
+  const uint8_t *sparse_index; /* 32 bit block and 16 bit offset */
+  const uint8_t *block_length; /* 16 bit values in block minus 1 */
+  const uint8_t *data;
+  uint64_t      *base64; /* lowest code of each length, left aligned */
+  uint8_t       *symlen; /* values in symbol minus 1 */
+  int            nsyms;
+  uint16_t       map_idx[4]; /* dtz_map offsets of win, loss, cursed, blessed */
+} PairsData;
+
+typedef struct {
+  uint64_t       key;  /* material key of table */
+  uint64_t       key2; /* material key with colors swapped */
+  int            dtz;
+  void          *map;
+  size_t         size;
+  const uint8_t *dtz_map;
+  int            pieces;
+  int            has_pawns;
+  int            has_unique;    /* some piece besides kings is alone */
+  int            pawn_count[2]; /* leading color first */
+  PairsData      items[2][4];   /* [side to move][file of leading pawn] */
+} Table;
+
+typedef struct {
+  uint64_t key;
+  Table   *wdl;
+  Table   *dtz;
+} HashEntry;
+
+int tb_largest;
+int tb_probe_depth = 1;
+
+static HashEntry hash[TB_HASH];
+static Table   **tables;
+static int       ntables;
+
+static int      map_b1h1h7[64];
+static int      map_a1d1d4[64];
+static int      map_kk[10][64];
+static uint64_t binomial[6][64];
+static int      map_pawns[64];
+static int      lead_pawn_idx[6][64];
+static int      lead_pawns_size[6][4];
+
+static inline uint16_t
+le16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static inline uint32_t
+le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t
+be32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline uint64_t
+be64(const uint8_t *p)
+{
+  return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static inline int
+off_a1h8(int sq)
+{
+  return (sq >> 3) - (sq & 7);
+}
+
+static inline int
+sign(int x)
+{
+  return (x > 0) - (x < 0);
+}
+
+/* Key of counts of pieces besides kings, 4 bits each. */
+static uint64_t
+material_key(int counts[2][6], int mirror)
+{
+  uint64_t key = 0;
+  for (Color c = WHITE; c <= BLACK; c++)
+    for (PieceType pt = PAWN; pt < KING; pt++)
+      key |= (uint64_t)counts[c ^ mirror][pt] << 4 * (5 * c + pt);
+  return key;
+}
+
+static HashEntry *
+find(uint64_t key)
+{
+  uint32_t i = (key * 0x9E3779B97F4A7C15ULL) >> (64 - TB_HASH_BITS);
+  while (hash[i].key && hash[i].key != key)
+    i = (i + 1) & (TB_HASH - 1);
+  return hash + i;
+}
+
+static void
+init_encoding(void)
+{
+  int code, idx, avail = 47;
+
+  for (int sq = 0, code = 0; sq < 64; sq++)
+    if (off_a1h8(sq) < 0)
+      map_b1h1h7[sq] = code++;
+
+  /* a1-d1-d4 triangle, squares of the diagonal come last */
+  code = 0;
+  for (int sq = 0; sq < 28; sq++)
+    if (off_a1h8(sq) < 0 && (sq & 7) <= 3)
+      map_a1d1d4[sq] = code++;
+  for (int sq = 0; sq < 28; sq++)
+    if (!off_a1h8(sq) && (sq & 7) <= 3)
+      map_a1d1d4[sq] = code++;
+
+  /* 462 placements of two kings, with the first one in the triangle and
+     the second one not above the diagonal if the first one is on it */
+  code = 0;
+  for (idx = 0; idx < 10; idx++)
+    for (int s1 = 0; s1 < 28; s1++) {
+      if (map_a1d1d4[s1] != idx || (!idx && s1 != 1))
+        continue;
+      for (int s2 = 0; s2 < 64; s2++) {
+        if (abs((s1 & 7) - (s2 & 7)) <= 1 && abs((s1 >> 3) - (s2 >> 3)) <= 1)
+          continue;
+        if (!off_a1h8(s1) && off_a1h8(s2) >= 0)
+          continue;
+        map_kk[idx][s2] = code++;
+      }
+    }
+  for (idx = 0; idx < 10; idx++)
+    for (int s1 = 0; s1 < 28; s1++) {
+      if (map_a1d1d4[s1] != idx || (!idx && s1 != 1) || off_a1h8(s1))
+        continue;
+      for (int s2 = 0; s2 < 64; s2++)
+        if (!off_a1h8(s2) && (abs((s1 & 7) - (s2 & 7)) > 1 || abs((s1 >> 3) - (s2 >> 3)) > 1))
+          map_kk[idx][s2] = code++;
+    }
+
+  binomial[0][0] = 1;
+  for (int n = 1; n < 64; n++)
+    for (int k = 0; k < 6 && k <= n; k++)
+      binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0)
+                     + (k < n ? binomial[k][n - 1] : 0);
+
+  /* pawns on a2-h7, leading pawn has the highest value, it is nearest to
+     the edge and lowest */
+  for (int cnt = 1; cnt <= 5; cnt++)
+    for (int f = 0; f < 4; f++) {
+      idx = 0;
+      for (int r = 1; r < 7; r++) {
+        int sq = 8 * r + f;
+        if (cnt == 1) {
+          map_pawns[sq]     = avail--;
+          map_pawns[sq ^ 7] = avail--;
+        }
+        lead_pawn_idx[cnt][sq] = idx;
+        idx += binomial[cnt - 1][map_pawns[sq]];
+      }
+      lead_pawns_size[cnt][f] = idx;
+    }
+}
+
+static int
+set_symlen(PairsData *d, int s, uint8_t *visited)
+{
+  const uint8_t *lr = d->btree + 3 * s;
+  int sl = (lr[1] & 0xF) << 8 | lr[0];
+  int sr = lr[2] << 4 | lr[1] >> 4;
+
+  visited[s] = 1;
+  if (sr == 0xFFF)
+    return 0;
+  if (!visited[sl])
+    d->symlen[sl] = set_symlen(d, sl, visited);
+  if (!visited[sr])
+    d->symlen[sr] = set_symlen(d, sr, visited);
+  return d->symlen[sl] + d->symlen[sr] + 1;
+}
+
+static const uint8_t *
+set_sizes(PairsData *d, const uint8_t *data)
+{
+  uint64_t size;
+  uint8_t *visited;
+  int padding, n, i;
+
+  d->flags = *data++;
+  if (d->flags & TB_SINGLE_VALUE) {
+    d->min_sym_len = *data++;
+    return data;
+  }
+
+  for (i = 0; d->group_len[i]; i++)
+    ;
+  size = d->group_idx[i];
+  d->block_size = 1ULL << *data++;
+  d->span       = 1ULL << *data++;
+  padding       = *data++;
+  d->nblocks    = le32(data);
+  data += 4;
+  d->max_sym_len = *data++;
+  d->min_sym_len = *data++;
+  d->lowest_sym  = data;
+
+  /* codes of one length are consecutive, longer codes are lower */
+  n = d->max_sym_len - d->min_sym_len + 1;
+  d->base64 = calloc(n, sizeof(uint64_t));
+  for (i = n - 2; i >= 0; i--)
+    d->base64[i] = (d->base64[i + 1] + le16(d->lowest_sym + 2 * i)
+                                     - le16(d->lowest_sym + 2 * (i + 1))) / 2;
+  for (i = 0; i < n; i++)
+    d->base64[i] <<= 64 - i - d->min_sym_len;
+  data += 2 * n;
+
+  d->nsyms = le16(data);
+  data += 2;
+  d->btree  = data;
+  d->symlen = calloc(d->nsyms, 1);
+  visited   = calloc(d->nsyms, 1);
+  for (int s = 0; s < d->nsyms; s++)
+    if (!visited[s])
+      d->symlen[s] = set_symlen(d, s, visited);
+  free(visited);
+
+  /* sizes of the arrays that follow all headers */
+  d->sparse_index = (const uint8_t *)(uintptr_t)((size + d->span - 1) / d->span);
+  d->block_length = (const uint8_t *)(uintptr_t)(d->nblocks + padding);
+  return data + 3 * d->nsyms + (d->nsyms & 1);
+}
+
+/* Splits pieces into groups encoded together, order gives positions of the
+   leading group and of remaining pawns among them. */
+static void
+set_groups(const Table *t, PairsData *d, const int order[2], int f)
+{
+  int n = 0, first = t->has_pawns ? 0 : t->has_unique ? 3 : 2;
+  int pp = t->has_pawns && t->pawn_count[1];
+  int next = pp ? 2 : 1, free_squares;
+  uint64_t idx = 1;
+
+  d->group_len[n] = 1;
+  for (int i = 1; i < t->pieces; i++)
+    if (--first > 0 || d->pieces[i] == d->pieces[i - 1])
+      d->group_len[n]++;
+    else
+      d->group_len[++n] = 1;
+  d->group_len[++n] = 0;
+
+  free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+  for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+    if (k == order[0]) {
+      d->group_idx[0] = idx;
+      idx *= t->has_pawns ? lead_pawns_size[d->group_len[0]][f]
+           : t->has_unique ? 31332 : 462;
+    } else if (k == order[1]) {
+      d->group_idx[1] = idx;
+      idx *= binomial[d->group_len[1]][48 - d->group_len[0]];
+    } else {
+      d->group_idx[next] = idx;
+      idx *= binomial[d->group_len[next]][free_squares];
+      free_squares -= d->group_len[next++];
+    }
+  }
+  d->group_idx[n] = idx;
+}
+
+/* Parses headers of mapped table, returns 0 on success. */
+static int
+init_table(Table *t)
+{
+  static const uint8_t magic[2][4] = {
+    { 0x71, 0xE8, 0x23, 0x5D }, { 0xD7, 0x66, 0x0C, 0xA5 },
+  };
+  const uint8_t *data = t->map;
+  int sides = !t->dtz && t->key != t->key2 ? 2 : 1;
+  int files = t->has_pawns ? 4 : 1;
+  int pp = t->has_pawns && t->pawn_count[1];
+  int order[2][2];
+  PairsData *d;
+
+  if (t->size < 16 || memcmp(data, magic[t->dtz], 4)
+  ||  !(data[4] & 2) != !t->has_pawns || !(data[4] & 1) != (t->key == t->key2))
+    return -1;
+  data += 5;
+
+  for (int f = 0; f < files; f++) {
+    order[0][0] = *data & 0xF;
+    order[0][1] = pp ? data[1] & 0xF : 0xF;
+    order[1][0] = *data >> 4;
+    order[1][1] = pp ? data[1] >> 4 : 0xF;
+    data += 1 + pp;
+    for (int k = 0; k < t->pieces; k++, data++)
+      for (int i = 0; i < sides; i++)
+        t->items[i][f].pieces[k] = i ? *data >> 4 : *data & 0xF;
+    for (int i = 0; i < sides; i++)
+      set_groups(t, &t->items[i][f], order[i], f);
+  }
+  data += (uintptr_t)data & 1;
+
+  for (int f = 0; f < files; f++)
+    for (int i = 0; i < sides; i++)
+      data = set_sizes(&t->items[i][f], data);
+
+  if (t->dtz) {
+    t->dtz_map = data;
+    for (int f = 0; f < files; f++) {
+      d = &t->items[0][f];
+      if (!(d->flags & TB_MAPPED))
+        continue;
+      if (d->flags & TB_WIDE) {
+        data += (uintptr_t)data & 1;
+        for (int i = 0; i < 4; i++) {
+          d->map_idx[i] = (data - t->dtz_map) / 2 + 1;
+          data += 2 * le16(data) + 2;
+        }
+      } else {
+        for (int i = 0; i < 4; i++) {
+          d->map_idx[i] = data - t->dtz_map + 1;
+          data += *data + 1;
+        }
+      }
+    }
+    data += (uintptr_t)data & 1;
+  }
+
+  /* set_sizes left sizes of these arrays in their pointers */
+  for (int f = 0; f < files; f++)
+    for (int i = 0; i < sides; i++) {
+      d = &t->items[i][f];
+      if (d->flags & TB_SINGLE_VALUE)
+        continue;
+      size_t n = (uintptr_t)d->sparse_index;
+      d->sparse_index = data;
+      data += 6 * n;
+    }
+  for (int f = 0; f < files; f++)
+    for (int i = 0; i < sides; i++) {
+      d = &t->items[i][f];
+      if (d->flags & TB_SINGLE_VALUE)
+        continue;
+      size_t n = (uintptr_t)d->block_length;
+      d->block_length = data;
+      data += 2 * n;
+    }
+  for (int f = 0; f < files; f++)
+    for (int i = 0; i < sides; i++) {
+      d = &t->items[i][f];
+      if (d->flags & TB_SINGLE_VALUE)
+        continue;
+      data = (const uint8_t *)(((uintptr_t)data + 63) & ~(uintptr_t)63);
+      d->data = data;
+      data += d->nblocks * d->block_size;
+    }
+
+  return data > (const uint8_t *)t->map + t->size ? -1 : 0;
+}
+
+static void
+free_table(Table *t)
+{
+  for (int i = 0; i < 2; i++)
+    for (int f = 0; f < 4; f++) {
+      free(t->items[i][f].base64);
+      free(t->items[i][f].symlen);
+    }
+  if (t->map)
+    munmap(t->map, t->size);
+  free(t);
+}
+
+/* Maps table of given name from one of directories in path. */
+static Table *
+open_table(const char *path, const char *name, int dtz)
+{
+  char file[4096];
+  const char *dir = path, *end;
+  struct stat st;
+  int counts[2][6] = { { 0 } }, c = WHITE, fd = -1;
+  Table *t;
+
+  for (; *dir && fd < 0; dir = *end ? end + 1 : end) {
+    end = dir + strcspn(dir, ":");
+    snprintf(file, sizeof(file), "%.*s/%s.%s", (int)(end - dir), dir, name,
+             dtz ? "rtbz" : "rtbw");
+    fd = open(file, O_RDONLY);
+  }
+  if (fd < 0)
+    return NULL;
+  if (!(t = calloc(1, sizeof(Table)))) {
+    close(fd);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0
+  ||  (t->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    t->map = NULL;
+    close(fd);
+    free_table(t);
+    return NULL;
+  }
+  close(fd);
+  t->size = st.st_size;
+  t->dtz  = dtz;
+
+  for (const char *s = name; *s; s++) {
+    if (*s == 'v')
+      c = BLACK;
+    else
+      counts[c][strchr("PNBRQK", *s) - "PNBRQK"]++;
+    t->pieces += *s != 'v';
+  }
+  t->key  = material_key(counts, 0);
+  t->key2 = material_key(counts, 1);
+  t->has_pawns = counts[WHITE][PAWN] + counts[BLACK][PAWN] > 0;
+  for (c = WHITE; c <= BLACK; c++)
+    for (PieceType pt = PAWN; pt < KING; pt++)
+      t->has_unique |= counts[c][pt] == 1;
+  /* side with fewer pawns leads, white if equal */
+  c = !counts[BLACK][PAWN]
+   || (counts[WHITE][PAWN] && counts[BLACK][PAWN] >= counts[WHITE][PAWN]) ? WHITE : BLACK;
+  t->pawn_count[0] = counts[c][PAWN];
+  t->pawn_count[1] = counts[!c][PAWN];
+
+  if (init_table(t)) {
+    printf("info string %s is not a valid syzygy table\n", file);
+    free_table(t);
+    return NULL;
+  }
+  return t;
+}
+
+/* Registers tables named name followed by pieces of from onwards, black
+   ones once name has 'v'. Pieces are added in order QRBNP, so that each
+   material is tried once. */
+static void
+add_tables(const char *path, char *name, int len, int black, const char *from)
+{
+  HashEntry *e;
+  Table *wdl, *dtz;
+  int pieces = len - black; /* without 'v' */
+
+  if (black) {
+    name[len] = '\0';
+    if (pieces > 2 && (wdl = open_table(path, name, 0))) {
+      dtz = open_table(path, name, 1);
+      tables[ntables++] = wdl;
+      if (dtz)
+        tables[ntables++] = dtz;
+      for (int i = 0; i < 1 + (wdl->key != wdl->key2); i++) {
+        e = find(i ? wdl->key2 : wdl->key);
+        e->key = i ? wdl->key2 : wdl->key;
+        e->wdl = wdl;
+        e->dtz = dtz;
+      }
+      if (pieces > tb_largest)
+        tb_largest = pieces;
+    }
+  }
+
+  /* white leaves room for black king */
+  if (pieces + 1 + !black <= TB_PIECES)
+    for (const char *p = from; *p; p++) {
+      name[len] = *p;
+      add_tables(path, name, len + 1, black, p);
+    }
+  if (!black) {
+    strcpy(name + len, "vK");
+    add_tables(path, name, len + 2, 1, "QRBNP");
+  }
+}
+
+void
+tb_free(void)
+{
+  for (int i = 0; i < ntables; i++)
+    free_table(tables[i]);
+  free(tables);
+  tables  = NULL;
+  ntables = 0;
+  tb_largest = 0;
+  memset(hash, 0, sizeof(hash));
+}
+
+int
+tb_init(const char *path)
+{
+  static int initialised;
+  char name[2 * TB_PIECES];
+
+  if (!initialised) {
+    init_encoding();
+    initialised = 1;
+  }
+  tb_free();
+  if (!*path || !strcmp(path, "<empty>"))
+    return 0;
+  /* at most one wdl and dtz table for each material */
+  if (!(tables = calloc(2 * TB_HASH, sizeof(Table *))))
+    return 0;
+
+  name[0] = 'K';
+  add_tables(path, name, 1, 0, "QRBNP");
+  return ntables;
+}
+
+/* Returns value at idx of compressed data. */
+static int
+decompress_pairs(const PairsData *d, uint64_t idx)
+{
+  const uint8_t *ptr, *lr;
+  uint64_t buf;
+  uint32_t block;
+  int offset, bits, len, sym, left;
+
+  if (d->flags & TB_SINGLE_VALUE)
+    return d->min_sym_len;
+
+  /* sparse index points to block of value at k * span + span / 2 */
+  block  = le32(d->sparse_index + 6 * (idx / d->span));
+  offset = le16(d->sparse_index + 6 * (idx / d->span) + 4)
+         + (int)(idx % d->span) - (int)(d->span / 2);
+  while (offset < 0)
+    offset += le16(d->block_length + 2 * --block) + 1;
+  while (offset > le16(d->block_length + 2 * block))
+    offset -= le16(d->block_length + 2 * block++) + 1;
+
+  ptr  = d->data + block * d->block_size;
+  buf  = be64(ptr);
+  ptr += 8;
+  bits = 64;
+  for (;;) {
+    for (len = 0; buf < d->base64[len]; len++)
+      ;
+    sym  = (buf - d->base64[len]) >> (64 - len - d->min_sym_len);
+    sym += le16(d->lowest_sym + 2 * len);
+    if (offset < d->symlen[sym] + 1)
+      break;
+    offset -= d->symlen[sym] + 1;
+    len  += d->min_sym_len;
+    buf <<= len;
+    bits -= len;
+    if (bits <= 32) {
+      bits += 32;
+      buf  |= (uint64_t)be32(ptr) << (64 - bits);
+      ptr  += 4;
+    }
+  }
+
+  /* expand pairs of symbol until offset points to a single value */
+  while (d->symlen[sym]) {
+    lr   = d->btree + 3 * sym;
+    left = (lr[1] & 0xF) << 8 | lr[0];
+    if (offset < d->symlen[left] + 1) {
+      sym = left;
+    } else {
+      offset -= d->symlen[left] + 1;
+      sym = lr[2] << 4 | lr[1] >> 4;
+    }
+  }
+  lr = d->btree + 3 * sym;
+  return (lr[1] & 0xF) << 8 | lr[0];
+}
+
+static int
+pawns_cmp(const void *a, const void *b)
+{
+  return map_pawns[*(const int *)a] - map_pawns[*(const int *)b];
+}
+
+static int
+square_cmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+/* Returns value of pos stored in wdl or dtz table, state is changed only if
+   the probe fails or dtz table has the other side to move. */
+static int
+probe_table(const Position *pos, int dtz, WDL wdl, int *state)
+{
+  int counts[2][6], squares[TB_PIECES] = { 0 }, pieces[TB_PIECES], tmp;
+  int size = 0, lead_cnt = 0, flip, stm, file = 0, next = 0, value;
+  int remaining_pawns, *group;
+  uint64_t key, idx, n;
+  U64 b, lead = 0;
+  const PairsData *d;
+  const Table *t;
+  HashEntry *e;
+
+  for (Color c = WHITE; c <= BLACK; c++)
+    for (PieceType pt = PAWN; pt <= KING; pt++)
+      counts[c][pt] = popcount(pos->piece[pt] & pos->color[c]);
+  if (popcount(~pos->empty) == 2)
+    return 0;
+  key = material_key(counts, 0);
+  e = find(key);
+  if (e->key != key || !(t = dtz ? e->dtz : e->wdl)) {
+    *state = PROBE_FAIL;
+    return 0;
+  }
+
+  /* tables have the stronger side as white and symmetric ones only white
+     to move, otherwise colors are swapped and board is mirrored */
+  flip = (t->key == t->key2 && pos->turn == BLACK) || key != t->key;
+  stm  = flip ^ pos->turn;
+
+  /* tables of pawns are split by file of leading pawn */
+  if (t->has_pawns) {
+    Color c = (t->items[0][0].pieces[0] >> 3) ^ flip;
+    lead = b = pos->piece[PAWN] & pos->color[c];
+    while (b)
+      squares[size++] = pop_lsb(&b) ^ (flip ? 0 : 56);
+    lead_cnt = size;
+    for (int i = 1; i < lead_cnt; i++)
+      if (map_pawns[squares[i]] > map_pawns[squares[0]])
+        tmp = squares[0], squares[0] = squares[i], squares[i] = tmp;
+    file = (squares[0] & 7) < 4 ? squares[0] & 7 : 7 - (squares[0] & 7);
+  }
+
+  if (dtz && (t->items[0][file].flags & TB_STM) != stm
+  &&  (t->key != t->key2 || t->has_pawns)) {
+    *state = PROBE_CHANGE_STM;
+    return 0;
+  }
+
+  b = ~pos->empty & ~lead;
+  while (b) {
+    Square sq = pop_lsb(&b);
+    squares[size] = sq ^ (flip ? 0 : 56);
+    pieces[size++] = (pos->board[sq] + 1) | ((((pos->color[BLACK] >> sq) & 1) ^ flip) << 3);
+  }
+
+  d = &t->items[dtz ? 0 : stm][file];
+
+  /* pieces in order of the table */
+  for (int i = lead_cnt; i < size - 1; i++)
+    for (int j = i + 1; j < size; j++)
+      if (d->pieces[i] == pieces[j]) {
+        tmp = pieces[i], pieces[i] = pieces[j], pieces[j] = tmp;
+        tmp = squares[i], squares[i] = squares[j], squares[j] = tmp;
+        break;
+      }
+
+  /* leading piece goes to files a-d */
+  if ((squares[0] & 7) > 3)
+    for (int i = 0; i < size; i++)
+      squares[i] ^= 7;
+
+  if (t->has_pawns) {
+    idx = lead_pawn_idx[lead_cnt][squares[0]];
+    qsort(squares + 1, lead_cnt - 1, sizeof(int), pawns_cmp);
+    for (int i = 1; i < lead_cnt; i++)
+      idx += binomial[i][map_pawns[squares[i]]];
+  } else {
+    /* leading piece goes to ranks 1-4 and below a1-h8 diagonal */
+    if (squares[0] >> 3 > 3)
+      for (int i = 0; i < size; i++)
+        squares[i] ^= 56;
+    for (int i = 0; i < d->group_len[0]; i++) {
+      if (!off_a1h8(squares[i]))
+        continue;
+      if (off_a1h8(squares[i]) > 0)
+        for (int j = i; j < size; j++)
+          squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+      break;
+    }
+
+    if (t->has_unique) {
+      int adjust1 = squares[1] > squares[0];
+      int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+      if (off_a1h8(squares[0]))
+        idx = (map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62
+            + squares[2] - adjust2;
+      else if (off_a1h8(squares[1]))
+        idx = (6 * 63 + (squares[0] >> 3) * 28 + map_b1h1h7[squares[1]]) * 62
+            + squares[2] - adjust2;
+      else if (off_a1h8(squares[2]))
+        idx = 6 * 63 * 62 + 4 * 28 * 62
+            + (squares[0] >> 3) * 7 * 28
+            + ((squares[1] >> 3) - adjust1) * 28
+            + map_b1h1h7[squares[2]];
+      else
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28
+            + (squares[0] >> 3) * 7 * 6
+            + ((squares[1] >> 3) - adjust1) * 6
+            + (squares[2] >> 3) - adjust2;
+    } else {
+      idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+    }
+  }
+
+  /* remaining groups in ascending order of squares, each square counted
+     without squares of previous groups below it */
+  idx *= d->group_idx[0];
+  group = squares + d->group_len[0];
+  remaining_pawns = t->has_pawns && t->pawn_count[1];
+  while (d->group_len[++next]) {
+    qsort(group, d->group_len[next], sizeof(int), square_cmp);
+    n = 0;
+    for (int i = 0; i < d->group_len[next]; i++) {
+      int adjust = 0;
+      for (int *s = squares; s < group; s++)
+        adjust += group[i] > *s;
+      n += binomial[i + 1][group[i] - adjust - 8 * remaining_pawns];
+    }
+    remaining_pawns = 0;
+    idx += n * d->group_idx[next];
+    group += d->group_len[next];
+  }
+
+  value = decompress_pairs(d, idx);
+  if (!dtz)
+    return value - 2;
+
+  /* dtz values are stored for wins and losses separately, in moves unless
+     the table says plies */
+  if (d->flags & TB_MAPPED) {
+    static const int wdl_map[] = { 1, 3, 0, 2, 0 };
+    int i = d->map_idx[wdl_map[wdl + 2]] + value;
+    value = d->flags & TB_WIDE ? le16(t->dtz_map + 2 * i) : t->dtz_map[i];
+  }
+  if ((wdl == TB_WIN && !(d->flags & TB_WIN_PLIES))
+  ||  (wdl == TB_LOSS && !(d->flags & TB_LOSS_PLIES))
+  ||  wdl == TB_CURSED_WIN || wdl == TB_BLESSED_LOSS)
+    value *= 2;
+  return value + 1;
+}
+
+static int
+legal_moves(Position *pos, Move *move_list)
+{
+  Move *last = generate_moves(ALL, move_list, pos);
+  return process_moves(pos, move_list, last, MOVE_NONE) - move_list;
+}
+
+static inline int
+is_capture(const Position *pos, Move m)
+{
+  return pos->board[to_sq(m)] != NONE || type_of(m) == EN_PASSANT;
+}
+
+/* Position repeated since last capture or pawn move. */
+static int
+repeated(const Position *pos)
+{
+  for (int i = pos->game_ply - 1; i >= pos->game_ply - pos->st->fifty_move_rule; i--)
+    if (pos->reps[i] == pos->key)
+      return 1;
+  return 0;
+}
+
+/* Dtz of a position just before a capture or pawn move with result wdl. */
+static int
+before_zeroing(WDL wdl)
+{
+  return wdl == TB_WIN         ?  1
+       : wdl == TB_CURSED_WIN   ?  101
+       : wdl == TB_BLESSED_LOSS ? -101
+       : wdl == TB_LOSS         ? -1 : 0;
+}
+
+/* Resolves captures, which tables do not store correctly if they are the
+   only moves or en passant ones. With zeroing also pawn moves are tried, as
+   dtz tables store nonsense if best move is one of them. */
+static WDL
+probe_ab(Position *pos, int zeroing, int *state)
+{
+  Move move_list[256], move;
+  WDL value, best = TB_LOSS;
+  int total, cnt = 0, no_more;
+
+  total = legal_moves(pos, move_list);
+  for (int i = 0; i < total; i++) {
+    move = move_of(move_list[i]);
+    if (!is_capture(pos, move) && (!zeroing || pos->board[from_sq(move)] != PAWN))
+      continue;
+    cnt++;
+    do_move(pos, move);
+    value = -probe_ab(pos, 0, state);
+    undo_move(pos, move);
+    if (*state == PROBE_FAIL)
+      return TB_DRAW;
+    if (value > best) {
+      best = value;
+      if (value >= TB_WIN) {
+        *state = PROBE_ZEROING;
+        return value;
+      }
+    }
+  }
+
+  no_more = cnt && cnt == total;
+  if (no_more) {
+    value = best;
+  } else {
+    value = probe_table(pos, 0, TB_DRAW, state);
+    if (*state == PROBE_FAIL)
+      return TB_DRAW;
+  }
+
+  if (best >= value) {
+    *state = best > TB_DRAW || no_more ? PROBE_ZEROING : PROBE_OK;
+    return best;
+  }
+  *state = PROBE_OK;
+  return value;
+}
+
+WDL
+tb_probe_wdl(Position *pos, int *success)
+{
+  int state = PROBE_OK;
+  WDL wdl = probe_ab(pos, 0, &state);
+  *success = state != PROBE_FAIL;
+  return wdl;
+}
+
+static int
+probe_dtz(Position *pos, int *state)
+{
+  Move move_list[256], replies[256], move;
+  int dtz, min = 0xFFFF, zeroing, n;
+  WDL wdl;
+
+  *state = PROBE_OK;
+  wdl = probe_ab(pos, 1, state);
+  if (*state == PROBE_FAIL || wdl == TB_DRAW)
+    return 0;
+  if (*state == PROBE_ZEROING)
+    return before_zeroing(wdl);
+
+  dtz = probe_table(pos, 1, wdl, state);
+  if (*state == PROBE_FAIL)
+    return 0;
+  if (*state != PROBE_CHANGE_STM)
+    return (dtz + 100 * (wdl == TB_BLESSED_LOSS || wdl == TB_CURSED_WIN)) * sign(wdl);
+
+  /* table has the other side to move, best move is found by 1 ply search */
+  n = legal_moves(pos, move_list);
+  for (int i = 0; i < n; i++) {
+    move = move_of(move_list[i]);
+    zeroing = is_capture(pos, move) || pos->board[from_sq(move)] == PAWN;
+    do_move(pos, move);
+    /* dtz of zeroing moves is known before they are played */
+    dtz = zeroing ? -before_zeroing(probe_ab(pos, 0, state)) : -probe_dtz(pos, state);
+    if (dtz == 1 && in_check(pos) && !legal_moves(pos, replies))
+      min = 1;
+    if (!zeroing)
+      dtz += sign(dtz);
+    if (dtz < min && sign(dtz) == sign(wdl))
+      min = dtz;
+    undo_move(pos, move);
+    if (*state == PROBE_FAIL)
+      return 0;
+  }
+  return min == 0xFFFF ? -1 : min;
+}
+
+int
+tb_probe_dtz(Position *pos, int *success)
+{
+  int state;
+  int dtz = probe_dtz(pos, &state);
+  *success = state != PROBE_FAIL;
+  return dtz;
+}
+
+/* Ranks root moves by dtz, wins that the fifty move rule cannot spoil rank
+   equally, so that search picks among them. */
+static int
+rank_dtz(Position *pos, Move *moves, int n, int *rank)
+{
+  Move move_list[256], move;
+  int cnt50 = pos->st->fifty_move_rule, rep = repeated(pos);
+  int state = PROBE_OK, dtz;
+
+  for (int i = 0; i < n; i++) {
+    move = move_of(moves[i]);
+    do_move(pos, move);
+    if (!pos->st->fifty_move_rule) {
+      dtz = before_zeroing(-probe_ab(pos, 0, &state));
+    } else if (pos->st->fifty_move_rule >= 100 || repeated(pos)) {
+      dtz = 0;
+    } else {
+      dtz = -probe_dtz(pos, &state);
+      dtz += sign(dtz);
+    }
+    if (dtz == 2 && in_check(pos) && !legal_moves(pos, move_list))
+      dtz = 1;
+    undo_move(pos, move);
+    if (state == PROBE_FAIL)
+      return -1;
+
+    rank[i] = dtz > 0 ? (dtz + cnt50 <= 99 && !rep ? MAX_DTZ : MAX_DTZ / 2 - (dtz + cnt50))
+            : dtz < 0 ? (-dtz * 2 + cnt50 < 100 ? -MAX_DTZ : -MAX_DTZ / 2 + (-dtz + cnt50))
+            : 0;
+  }
+  return 0;
+}
+
+static int
+rank_wdl(Position *pos, Move *moves, int n, int *rank)
+{
+  static const int wdl_rank[] = {
+    -MAX_DTZ, -MAX_DTZ + 101, 0, MAX_DTZ - 101, MAX_DTZ,
+  };
+  Move move;
+  int state = PROBE_OK;
+  WDL wdl;
+
+  for (int i = 0; i < n; i++) {
+    move = move_of(moves[i]);
+    do_move(pos, move);
+    wdl = pos->st->fifty_move_rule >= 100 || repeated(pos) ? TB_DRAW
+        : -probe_ab(pos, 0, &state);
+    undo_move(pos, move);
+    if (state == PROBE_FAIL)
+      return -1;
+    rank[i] = wdl_rank[wdl + 2];
+  }
+  return 0;
+}
+
+int
+tb_root_moves(Position *pos, Move *moves, int n, int *dtz, WDL *wdl)
+{
+  int rank[256], best = -MAX_DTZ, k = 0;
+  Move tmp;
+
+  if (!tb_largest || popcount(~pos->empty) > tb_largest || pos->st->castle || !n)
+    return 0;
+
+  *dtz = 1;
+  if (rank_dtz(pos, moves, n, rank)) {
+    *dtz = 0;
+    if (rank_wdl(pos, moves, n, rank))
+      return 0;
+  }
+
+  for (int i = 0; i < n; i++)
+    best = rank[i] > best ? rank[i] : best;
+  for (int i = 0; i < n; i++)
+    if (rank[i] == best)
+      tmp = moves[k], moves[k++] = moves[i], moves[i] = tmp;
+
+  if (*dtz)
+    *wdl = best >= MAX_DTZ / 2 - 100 ? TB_WIN
+         : best > 0 ? TB_CURSED_WIN : !best ? TB_DRAW
+         : best > -MAX_DTZ / 2 + 100 ? TB_BLESSED_LOSS : TB_LOSS;
+  else
+    *wdl = best == MAX_DTZ ? TB_WIN : best > 0 ? TB_CURSED_WIN : !best ? TB_DRAW
+         : best > -MAX_DTZ ? TB_BLESSED_LOSS : TB_LOSS;
+  return k;
+}
@@ -0,0 +1,39 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __TBPROBE_H__
+#define __TBPROBE_H__
+
+#include "chesslib.h"
+#include "position.h"
+
+#define TB_PIECES 7 /* max pieces of a syzygy table, kings included */
+
+/* Win, draw, loss of side to move, cursed win and blessed loss are wins and
+   losses that the fifty move rule turns into draws. */
+typedef enum {
+  TB_LOSS         = -2,
+  TB_BLESSED_LOSS = -1,
+  TB_DRAW         =  0,
+  TB_CURSED_WIN   =  1,
+  TB_WIN          =  2,
+} WDL;
+
+extern int tb_largest;     /* pieces of largest table found, 0 if none */
+extern int tb_probe_depth; /* min depth of probes with tb_largest pieces */
+
+/* Maps syzygy tables found in directories of path separated by ':',
+   unmaps previous ones. Returns number of tables found. */
+int tb_init(const char *path);
+void tb_free(void);
+/* Returns WDL of pos, which must have no castling rights. Sets *success to 0
+   if some table is missing. */
+WDL tb_probe_wdl(Position *pos, int *success);
+/* Returns plies to next capture or pawn move in optimal play, positive if
+   side to move wins, negative if it loses, 0 for draws. Values of cursed
+   wins and blessed losses are 100 plies further from 0. */
+int tb_probe_dtz(Position *pos, int *success);
+/* Moves legal root moves that keep the best tablebase result to the front,
+   returns their number, or 0 if pos cannot be probed. Sets *dtz to 1 if dtz
+   tables were used and *wdl to result of pos. */
+int tb_root_moves(Position *pos, Move *moves, int n, int *dtz, WDL *wdl);
+
+#endif /* __TBPROBE_H__ */
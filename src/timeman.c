@@ -0,0 +1,55 @@
+/* See LICENSE file for file for copyright and license details */
+#include "misc.h"
+#include "search.h"
+#include "timeman.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Scale of soft limit by number of iterations with unchanged best move. */
+static const double stability_scale[] = { 2.2, 1.5, 1.1, 0.9, 0.8, 0.75 };
+
+static int fixed_time; /* movetime was given, search uses all of it */
+
+void
+time_init(int time, int inc, int movestogo, int movetime)
+{
+  int avail;
+
+  info.timeset = 0;
+  fixed_time   = movetime != -1;
+
+  if (fixed_time) {
+    info.timeset  = 1;
+    info.softtime = MAX(movetime - MOVE_OVERHEAD, 1);
+    info.stoptime = info.starttime + info.softtime;
+    return;
+  }
+
+  if (time == -1)
+    return;
+
+  /* without movestogo assume the game lasts 30 more moves */
+  movestogo = movestogo > 0 ? MIN(movestogo, 50) : 30;
+  avail = MAX(time - MOVE_OVERHEAD, 1);
+
+  info.timeset  = 1;
+  info.softtime = MIN(avail / movestogo + inc * 3 / 4, avail * 3 / 4);
+  info.stoptime = info.starttime + MIN(info.softtime * 4, avail * 3 / 4);
+}
+
+int
+time_stop_iteration(int stability, int score_drop, double best_nodes)
+{
+  double scale;
+
+  if (!info.timeset || fixed_time)
+    return 0;
+
+  /* unstable best move, dropping score and unclear choice need more time */
+  scale  = stability_scale[MIN(stability, 5)];
+  scale *= 1.0 + MIN(MAX(score_drop, 0), 100) / 200.0;
+  scale *= (1.5 - best_nodes) * 1.25;
+
+  return get_time() - info.starttime > info.softtime * scale;
+}
@@ -0,0 +1,21 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __TIMEMAN_H__
+#define __TIMEMAN_H__
+
+#define MOVE_OVERHEAD 30 /* ms reserved for communication with gui */
+
+/* Sets soft and hard time limits of search from clock of the side to move.
+   time      - remaining time in ms or -1 if not given
+   inc       - increment per move in ms
+   movestogo - moves to next time control or 0 if not given
+   movetime  - exact time for this move in ms or -1 if not given */
+void time_init(int time, int inc, int movestogo, int movetime);
+
+/* Returns 1 if search should not start a new iteration. With movetime only
+   the hard limit stops search.
+   stability  - number of iterations in which best move did not change
+   score_drop - how much value dropped since previous iteration
+   best_nodes - fraction of root nodes spent on the best move */
+int time_stop_iteration(int stability, int score_drop, double best_nodes);
+
+#endif /* __TIMEMAN_H__ */
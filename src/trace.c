@@ -0,0 +1,67 @@
+/* See LICENSE file for file for copyright and license details */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chesslib.h"
+#include "trace.h"
+
+int trace_max_ply   = MAX_PLY;
+int trace_max_nodes = 1000000;
+
+static TraceRecord *records;
+static int          nrecords;
+static int          cap;
+
+void
+trace_start(void)
+{
+  if (cap != trace_max_nodes) {
+    free(records);
+    cap = (records = malloc(sizeof(TraceRecord) * trace_max_nodes))
+        ? trace_max_nodes : 0;
+  }
+  nrecords = 0;
+}
+
+TraceRecord *
+trace_new(void)
+{
+  return nrecords < cap ? records + nrecords++ : NULL;
+}
+
+void
+trace_write(void)
+{
+  FILE *f;
+  uint32_t header[3] = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord) };
+
+  if (!(f = fopen(TRACE_FILE, "wb"))) {
+    printf("info string cannot open %s\n", TRACE_FILE);
+    return;
+  }
+  fwrite(header, sizeof(header), 1, f);
+  fwrite(records, sizeof(TraceRecord), nrecords, f);
+  fclose(f);
+  printf("info string trace of %d nodes written to %s\n", nrecords, TRACE_FILE);
+}
+
+/* Inverse of scoring in moveorder.c. */
+Stage
+trace_stage(Move m)
+{
+  int score = m >> 16;
+
+  if (move_of(m) == MOVE_NULL)
+    return STAGE_NULL;
+  if (move_of(m) == MOVE_NONE)
+    return STAGE_NONE;
+  if (score == 15000)
+    return STAGE_HASH;
+  if (score == 10000)
+    return STAGE_PROMOTION;
+  if (score >= 9000 || type_of(m) == EN_PASSANT)
+    return STAGE_CAPTURE;
+  if (score >= 7000)
+    return STAGE_KILLER;
+  return STAGE_QUIET;
+}
@@ -0,0 +1,63 @@
+/* See LICENSE file for file for copyright and license details */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <inttypes.h>
+
+#include "chesslib.h"
+#include "tt.h"
+
+#define TRACE_MAGIC   0x43525442 /* "BTRC" */
+#define TRACE_VERSION 1
+
+typedef enum {
+  NODE_PV,  /* open window */
+  NODE_CUT, /* expected to fail high */
+  NODE_ALL, /* expected to fail low */
+  NODE_QS,  /* quiescence */
+} NodeType;
+
+/* Move ordering stage of the move leading to a node. */
+typedef enum {
+  STAGE_NONE,      /* root, null move or research of the same node */
+  STAGE_HASH,
+  STAGE_PROMOTION,
+  STAGE_CAPTURE,
+  STAGE_KILLER,
+  STAGE_QUIET,
+  STAGE_NULL,
+} Stage;
+
+/* Searched node, records are in order in which nodes were entered, record
+   of a node is followed by records of its subtree. */
+typedef struct {
+  Key      key;
+  int32_t  alpha;  /* window the node was searched with */
+  int32_t  beta;
+  int32_t  value;  /* returned value */
+  uint16_t move;   /* move leading to the node, MOVE_NONE if stage is none */
+  uint16_t level;  /* number of records the node is nested in */
+  uint8_t  ply;
+  int8_t   depth;  /* 0 in quiescence */
+  uint8_t  type;   /* NodeType */
+  uint8_t  stage;  /* Stage */
+  uint32_t unused;
+} TraceRecord;
+
+/* File starts with magic, version and size of a record as uint32_t, records
+   follow until its end. */
+#define TRACE_FILE "trace.bin"
+
+extern int trace_max_ply;   /* nodes deeper than that are not recorded */
+extern int trace_max_nodes; /* max number of recorded nodes */
+
+/* Empties trace before a new search. */
+void trace_start(void);
+/* Returns record for a new node or NULL if budget is exhausted. */
+TraceRecord *trace_new(void);
+/* Writes trace of the last search to TRACE_FILE. */
+void trace_write(void);
+/* Returns ordering stage of move scored by process_moves. */
+Stage trace_stage(Move m);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,175 @@
+/* See LICENSE file for file for copyright and license details */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chesslib.h"
+#include "trace.h"
+
+/* Summary of subtrees of a group of moves or nodes. */
+typedef struct {
+  uint64_t cnt;   /* number of subtrees */
+  uint64_t nodes; /* nodes in them */
+  uint64_t hits;  /* subtrees that beat their bound, meaning depends on table */
+} Group;
+
+/* Root move with summary of its searches. */
+typedef struct {
+  Move     move;
+  Group    g;
+  int32_t  value; /* value of last search from root point of view */
+} RootMove;
+
+static const char *stage_names[] = {
+  [STAGE_NONE]      = "none",
+  [STAGE_HASH]      = "hash",
+  [STAGE_PROMOTION] = "promotion",
+  [STAGE_CAPTURE]   = "capture",
+  [STAGE_KILLER]    = "killer",
+  [STAGE_QUIET]     = "quiet",
+  [STAGE_NULL]      = "null",
+};
+
+static const char *type_names[] = {
+  [NODE_PV]  = "pv",
+  [NODE_CUT] = "cut",
+  [NODE_ALL] = "all",
+  [NODE_QS]  = "qs",
+};
+
+static void
+move_str(char *s, Move m)
+{
+  static const char pc[] = { 'p', 'n', 'b', 'r', 'q', 'k' };
+
+  s[0] = 'a' + from_sq(m) % 8;
+  s[1] = '8' - from_sq(m) / 8;
+  s[2] = 'a' + to_sq(m) % 8;
+  s[3] = '8' - to_sq(m) / 8;
+  s[4] = type_of(m) == PROMOTION ? pc[promotion_type(m)] : '\0';
+  s[5] = '\0';
+}
+
+static double
+pct(uint64_t a, uint64_t b)
+{
+  return b ? 100.0 * a / b : 0.0;
+}
+
+static void
+print_group(const char *name, const Group *g, uint64_t total)
+{
+  printf("%-10s %10lu %12lu %7.2f%% %10.1f %7.2f%%\n", name, g->cnt, g->nodes,
+         pct(g->nodes, total), g->cnt ? (double)g->nodes / g->cnt : 0.0,
+         pct(g->hits, g->cnt));
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *file = argc > 1 ? argv[1] : TRACE_FILE;
+  uint32_t header[3];
+  TraceRecord *r;
+  FILE *f;
+  long n, i, top, *stack, *parent, *size;
+  RootMove roots[256];
+  int nroots = 0, k;
+  Group stages[STAGE_NULL + 1] = { 0 }, types[NODE_QS + 1] = { 0 };
+  char s[6];
+
+  if (!(f = fopen(file, "rb"))) {
+    fprintf(stderr, "cannot open %s\n", file);
+    return 1;
+  }
+  if (fread(header, sizeof(header), 1, f) != 1 || header[0] != TRACE_MAGIC
+  ||  header[1] != TRACE_VERSION || header[2] != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s is not a trace of this version\n", file);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  n = (ftell(f) - sizeof(header)) / sizeof(TraceRecord);
+  fseek(f, sizeof(header), SEEK_SET);
+
+  r      = malloc(n * sizeof(*r) + 1);
+  stack  = malloc(n * sizeof(*stack) + 1);
+  parent = malloc(n * sizeof(*parent) + 1);
+  size   = malloc(n * sizeof(*size) + 1);
+  if (!r || !stack || !parent || !size) {
+    fprintf(stderr, "cannot allocate %ld records\n", n);
+    return 1;
+  }
+  n = fread(r, sizeof(*r), n, f);
+  fclose(f);
+
+  /* subtree of a record ends before next record that is not nested in it */
+  for (i = 0, top = 0; i <= n; i++) {
+    while (top && (i == n || r[stack[top - 1]].level >= r[i].level)) {
+      top--;
+      size[stack[top]] = i - stack[top];
+    }
+    if (i < n) {
+      parent[i] = top ? stack[top - 1] : -1;
+      stack[top++] = i;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    types[r[i].type].cnt++;
+    types[r[i].type].nodes += size[i];
+    types[r[i].type].hits  += r[i].value >= r[i].beta;
+
+    /* only moves, not researches of the same node */
+    if (parent[i] < 0 || r[i].ply != r[parent[i]].ply + 1)
+      continue;
+
+    stages[r[i].stage].cnt++;
+    stages[r[i].stage].nodes += size[i];
+    stages[r[i].stage].hits  += r[i].value <= r[i].alpha;
+
+    if (r[parent[i]].ply)
+      continue;
+    for (k = 0; k < nroots && roots[k].move != r[i].move; k++)
+      ;
+    if (k == nroots && nroots < 256)
+      roots[nroots++] = (RootMove){ .move = r[i].move };
+    if (k < nroots) {
+      roots[k].g.cnt++;
+      roots[k].g.nodes += size[i];
+      roots[k].g.hits  += r[i].value <= r[i].alpha;
+      roots[k].value    = -r[i].value;
+    }
+  }
+
+  printf("%ld nodes\n\n", n);
+
+  printf("%-10s %10s %12s %8s %10s %8s %7s\n", "root move", "searches",
+         "nodes", "share", "avg", "raised", "value");
+  for (k = 0; k < nroots; k++) {
+    move_str(s, roots[k].move);
+    printf("%-10s %10lu %12lu %7.2f%% %10.1f %7.2f%% %7d\n", s,
+           roots[k].g.cnt, roots[k].g.nodes, pct(roots[k].g.nodes, n),
+           (double)roots[k].g.nodes / roots[k].g.cnt,
+           pct(roots[k].g.hits, roots[k].g.cnt), roots[k].value);
+  }
+
+  /* raised - child failed low, so the move beat the bound of parent,
+     nested subtrees are counted in nodes of each of them */
+  printf("\n%-10s %10s %12s %8s %10s %8s\n", "stage", "moves", "nodes",
+         "share", "avg", "raised");
+  for (k = STAGE_HASH; k <= STAGE_NULL; k++)
+    print_group(stage_names[k], stages + k, n);
+
+  /* high - value of node reached beta */
+  printf("\n%-10s %10s %8s %10s %8s\n", "node type", "nodes", "share",
+         "avg", "high");
+  for (k = NODE_PV; k <= NODE_QS; k++)
+    printf("%-10s %10lu %7.2f%% %10.1f %7.2f%%\n", type_names[k], types[k].cnt,
+           pct(types[k].cnt, n),
+           types[k].cnt ? (double)types[k].nodes / types[k].cnt : 0.0,
+           pct(types[k].hits, types[k].cnt));
+
+  free(r);
+  free(stack);
+  free(parent);
+  free(size);
+  return 0;
+}
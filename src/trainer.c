@@ -0,0 +1,400 @@
+/* See LICENSE file for file for copyright and license details */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#undef INFINITY /* chesslib.h has its own */
+
+#include "chesslib.h"
+#include "datagen.h"
+#include "misc.h"
+#include "nnue.h"
+
+#define MAX_THREADS   64
+#define BATCH         16384
+#define LR            0.001
+#define LR_DECAY      0.9   /* learning rate multiplier after each epoch */
+#define WDL           0.25  /* weight of game result in target, rest is score */
+#define SIGMOID_SCALE 400.0 /* centipawns to win probability */
+#define VALIDATION    50    /* every n-th position is used for validation */
+#define MAX_WEIGHT    (127.0 / 64) /* int8 weights are scaled by 64 */
+
+/* Float network, quantized on export as described in nnue.h. */
+typedef struct {
+  float ft_w[NNUE_INPUTS * NNUE_HIDDEN];
+  float ft_b[NNUE_HIDDEN];
+  float l1_w[NNUE_L1 * 2 * NNUE_HIDDEN];
+  float l1_b[NNUE_L1];
+  float l2_w[NNUE_L2 * NNUE_L1];
+  float l2_b[NNUE_L2];
+  float out_w[NNUE_L2];
+  float out_b[1];
+} Net;
+
+#define NPARAMS (sizeof(Net) / sizeof(float))
+
+/* Work of one thread on a slice of batch. */
+typedef struct {
+  pthread_t handle;
+  int      *idx;  /* indices of positions */
+  int       n;
+  int       train; /* accumulate gradient, otherwise only loss */
+  Net      *grad;
+  double    loss;
+} Job;
+
+static PackedPos *data;
+static Net       *net, *adam_m, *adam_v;
+
+/* Vector kernels, n of vadd is arbitrary, others take multiples of 8. */
+
+/* dst += a * x */
+static inline void
+vaxpy(float *dst, float a, const float *x, int n)
+{
+#if defined(__AVX2__)
+  __m256 va = _mm256_set1_ps(a);
+  for (int i = 0; i < n; i += 8)
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                            _mm256_mul_ps(va, _mm256_loadu_ps(x + i))));
+#else
+  for (int i = 0; i < n; i++)
+    dst[i] += a * x[i];
+#endif
+}
+
+/* dst += x, used for sparse rows of feature transformer */
+static inline void
+vadd(float *dst, const float *x, int n)
+{
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                            _mm256_loadu_ps(x + i)));
+#endif
+  for (; i < n; i++)
+    dst[i] += x[i];
+}
+
+static inline float
+vdot(const float *a, const float *b, int n)
+{
+#if defined(__AVX2__)
+  __m256 s = _mm256_setzero_ps();
+  __m128 h;
+  for (int i = 0; i < n; i += 8)
+    s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  return _mm_cvtss_f32(h);
+#else
+  float s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i] * b[i];
+  return s;
+#endif
+}
+
+static inline float
+clip(float x)
+{
+  return x < 0 ? 0 : x > 1 ? 1 : x;
+}
+
+static inline float
+sigmoid(float x)
+{
+  return 1 / (1 + expf(-x));
+}
+
+/* Runs position through network, adds gradient of squared error to g if it
+   is not NULL, returns the error. */
+static float
+step(const PackedPos *pp, Net *g)
+{
+  int feats[2][32], n, stm = pp->turn;
+  float acc[2][NNUE_HIDDEN], in[2 * NNUE_HIDDEN], din[2 * NNUE_HIDDEN];
+  float h1[NNUE_L1], dh1[NNUE_L1], h2[NNUE_L2], dh2[NNUE_L2];
+  float y, p, t, dy, score, result;
+
+  n = unpack_features(pp, feats[WHITE], feats[BLACK]);
+
+  /* sparse first layer, at most 32 rows of weights for each perspective */
+  for (int c = WHITE; c <= BLACK; c++) {
+    memcpy(acc[c], net->ft_b, sizeof(acc[c]));
+    for (int i = 0; i < n; i++)
+      vadd(acc[c], net->ft_w + feats[c][i] * NNUE_HIDDEN, NNUE_HIDDEN);
+  }
+  for (int i = 0; i < NNUE_HIDDEN; i++) {
+    in[i]               = clip(acc[stm][i]);
+    in[NNUE_HIDDEN + i] = clip(acc[!stm][i]);
+  }
+
+  for (int o = 0; o < NNUE_L1; o++)
+    h1[o] = net->l1_b[o] + vdot(in, net->l1_w + o * 2 * NNUE_HIDDEN, 2 * NNUE_HIDDEN);
+  for (int o = 0; o < NNUE_L2; o++) {
+    h2[o] = net->l2_b[o];
+    for (int i = 0; i < NNUE_L1; i++)
+      h2[o] += net->l2_w[o * NNUE_L1 + i] * clip(h1[i]);
+  }
+  y = net->out_b[0];
+  for (int i = 0; i < NNUE_L2; i++)
+    y += net->out_w[i] * clip(h2[i]);
+
+  /* target mixes search score and game result, both for side to move */
+  score  = stm == WHITE ? pp->score : -pp->score;
+  result = (stm == WHITE ? pp->result : 2 - pp->result) / 2.0;
+  t = (1 - WDL) * sigmoid(score / SIGMOID_SCALE) + WDL * result;
+  p = sigmoid(y * NNUE_SCALE / SIGMOID_SCALE);
+
+  if (!g)
+    return (p - t) * (p - t);
+
+  dy = 2 * (p - t) * p * (1 - p) * NNUE_SCALE / SIGMOID_SCALE;
+
+  g->out_b[0] += dy;
+  for (int i = 0; i < NNUE_L2; i++) {
+    g->out_w[i] += dy * clip(h2[i]);
+    dh2[i] = h2[i] > 0 && h2[i] < 1 ? dy * net->out_w[i] : 0;
+  }
+
+  memset(dh1, 0, sizeof(dh1));
+  for (int o = 0; o < NNUE_L2; o++) {
+    g->l2_b[o] += dh2[o];
+    for (int i = 0; i < NNUE_L1; i++) {
+      g->l2_w[o * NNUE_L1 + i] += dh2[o] * clip(h1[i]);
+      dh1[i] += dh2[o] * net->l2_w[o * NNUE_L1 + i];
+    }
+  }
+
+  memset(din, 0, sizeof(din));
+  for (int o = 0; o < NNUE_L1; o++) {
+    if (h1[o] <= 0 || h1[o] >= 1)
+      continue;
+    g->l1_b[o] += dh1[o];
+    vaxpy(g->l1_w + o * 2 * NNUE_HIDDEN, dh1[o], in, 2 * NNUE_HIDDEN);
+    vaxpy(din, dh1[o], net->l1_w + o * 2 * NNUE_HIDDEN, 2 * NNUE_HIDDEN);
+  }
+
+  for (int i = 0; i < NNUE_HIDDEN; i++) {
+    din[i]               *= acc[stm][i]  > 0 && acc[stm][i]  < 1;
+    din[NNUE_HIDDEN + i] *= acc[!stm][i] > 0 && acc[!stm][i] < 1;
+  }
+  vadd(g->ft_b, din, NNUE_HIDDEN);
+  vadd(g->ft_b, din + NNUE_HIDDEN, NNUE_HIDDEN);
+  for (int i = 0; i < n; i++) {
+    vadd(g->ft_w + feats[stm][i]  * NNUE_HIDDEN, din,               NNUE_HIDDEN);
+    vadd(g->ft_w + feats[!stm][i] * NNUE_HIDDEN, din + NNUE_HIDDEN, NNUE_HIDDEN);
+  }
+
+  return (p - t) * (p - t);
+}
+
+static void *
+run_job(void *arg)
+{
+  Job *j = arg;
+
+  j->loss = 0;
+  if (j->train)
+    memset(j->grad, 0, sizeof(Net));
+  for (int i = 0; i < j->n; i++)
+    j->loss += step(data + j->idx[i], j->train ? j->grad : NULL);
+  return NULL;
+}
+
+/* Splits positions between threads, returns sum of their errors. */
+static double
+run(Job *jobs, int threads, int *idx, int n, int train)
+{
+  double loss = 0;
+
+  for (int t = 0; t < threads; t++) {
+    jobs[t].idx   = idx + (long)n * t / threads;
+    jobs[t].n     = (long)n * (t + 1) / threads - (long)n * t / threads;
+    jobs[t].train = train;
+    pthread_create(&jobs[t].handle, NULL, run_job, jobs + t);
+  }
+  for (int t = 0; t < threads; t++) {
+    pthread_join(jobs[t].handle, NULL);
+    loss += jobs[t].loss;
+  }
+  return loss;
+}
+
+/* Adam step with gradient summed over threads, int8 layers are kept in range
+   representable after quantization. */
+static void
+update(Job *jobs, int threads, int n, double lr, int t)
+{
+  float *p = (float *)net, *m = (float *)adam_m, *v = (float *)adam_v;
+  float *g = (float *)jobs[0].grad;
+  double c1 = 1 - pow(0.9, t), c2 = 1 - pow(0.999, t);
+
+  for (int k = 1; k < threads; k++)
+    vadd(g, (float *)jobs[k].grad, NPARAMS);
+
+  for (size_t i = 0; i < NPARAMS; i++) {
+    float gi = g[i] / n;
+    m[i] = 0.9   * m[i] + 0.1   * gi;
+    v[i] = 0.999 * v[i] + 0.001 * gi * gi;
+    p[i] -= lr * (m[i] / c1) / (sqrt(v[i] / c2) + 1e-8);
+  }
+
+  for (int i = 0; i < NNUE_L1 * 2 * NNUE_HIDDEN; i++)
+    net->l1_w[i] = fmaxf(-MAX_WEIGHT, fminf(MAX_WEIGHT, net->l1_w[i]));
+  for (int i = 0; i < NNUE_L2 * NNUE_L1; i++)
+    net->l2_w[i] = fmaxf(-MAX_WEIGHT, fminf(MAX_WEIGHT, net->l2_w[i]));
+  for (int i = 0; i < NNUE_L2; i++)
+    net->out_w[i] = fmaxf(-MAX_WEIGHT, fminf(MAX_WEIGHT, net->out_w[i]));
+}
+
+static float
+uniform(float a)
+{
+  return ((rand_uint64() >> 11) * (1.0 / 9007199254740992.0) * 2 - 1) * a;
+}
+
+static void
+init_net(void)
+{
+  for (int i = 0; i < NNUE_INPUTS * NNUE_HIDDEN; i++)
+    net->ft_w[i] = uniform(0.1);
+  for (int i = 0; i < NNUE_HIDDEN; i++)
+    net->ft_b[i] = 0.5;
+  for (int i = 0; i < NNUE_L1 * 2 * NNUE_HIDDEN; i++)
+    net->l1_w[i] = uniform(1 / sqrt(2 * NNUE_HIDDEN));
+  for (int i = 0; i < NNUE_L2 * NNUE_L1; i++)
+    net->l2_w[i] = uniform(1 / sqrt(NNUE_L1));
+  for (int i = 0; i < NNUE_L2; i++)
+    net->out_w[i] = uniform(1 / sqrt(NNUE_L2));
+}
+
+/* Writes n values rounded and clamped to given type, padded to 64 bytes. */
+#define WRITE(type, lo, hi, src, n, scale, f) do {                    \
+    type buf_[n];                                                     \
+    char pad_[64] = { 0 };                                            \
+    for (int i_ = 0; i_ < (n); i_++) {                                \
+      double x_ = round((src)[i_] * (scale));                        \
+      buf_[i_] = x_ < (lo) ? (lo) : x_ > (hi) ? (hi) : x_;            \
+    }                                                                 \
+    fwrite(buf_, sizeof(type), (n), f);                               \
+    fwrite(pad_, 1, (64 - sizeof(type) * (n) % 64) % 64, f);          \
+  } while (0)
+
+static int
+export(const char *file)
+{
+  NNUEHeader h = {
+    .magic = NNUE_MAGIC, .version = NNUE_VERSION, .inputs = NNUE_INPUTS,
+    .hidden = NNUE_HIDDEN, .l1 = NNUE_L1, .l2 = NNUE_L2,
+  };
+  const double s = 1 << NNUE_SHIFT;
+  FILE *f;
+
+  if (!(f = fopen(file, "wb")))
+    return -1;
+  fwrite(&h, sizeof(h), 1, f);
+  WRITE(int16_t, INT16_MIN, INT16_MAX, net->ft_w, NNUE_INPUTS * NNUE_HIDDEN, 127, f);
+  WRITE(int16_t, INT16_MIN, INT16_MAX, net->ft_b, NNUE_HIDDEN, 127, f);
+  WRITE(int8_t,  INT8_MIN,  INT8_MAX,  net->l1_w, NNUE_L1 * 2 * NNUE_HIDDEN, s, f);
+  WRITE(int32_t, INT32_MIN, INT32_MAX, net->l1_b, NNUE_L1, 127 * s, f);
+  WRITE(int8_t,  INT8_MIN,  INT8_MAX,  net->l2_w, NNUE_L2 * NNUE_L1, s, f);
+  WRITE(int32_t, INT32_MIN, INT32_MAX, net->l2_b, NNUE_L2, 127 * s, f);
+  WRITE(int8_t,  INT8_MIN,  INT8_MAX,  net->out_w, NNUE_L2, s, f);
+  WRITE(int32_t, INT32_MIN, INT32_MAX, net->out_b, 1, 127 * s, f);
+  return fclose(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int epochs, threads, n, ntrain, nvalid, batch, tmp, *train, *valid;
+  Job jobs[MAX_THREADS];
+  double lr = LR, loss;
+  FILE *f;
+  long size;
+  int t = 0, start;
+
+  if (argc < 3) {
+    printf("usage: %s data out [epochs] [threads]\n", argv[0]);
+    return 1;
+  }
+  epochs  = argc > 3 ? atoi(argv[3]) : 10;
+  threads = argc > 4 ? atoi(argv[4]) : 1;
+  threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+
+  if (!(f = fopen(argv[1], "rb"))) {
+    printf("cannot open %s\n", argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  n = size / sizeof(PackedPos);
+  data  = malloc(sizeof(PackedPos) * n + 1);
+  train = malloc(sizeof(int) * n + 1);
+  valid = malloc(sizeof(int) * n + 1);
+  net    = calloc(1, sizeof(Net));
+  adam_m = calloc(1, sizeof(Net));
+  adam_v = calloc(1, sizeof(Net));
+  if (!data || !train || !valid || !net || !adam_m || !adam_v) {
+    printf("cannot allocate memory for %d positions\n", n);
+    return 1;
+  }
+  for (int i = 0; i < threads; i++)
+    if (!(jobs[i].grad = malloc(sizeof(Net)))) {
+      printf("cannot allocate gradient of thread %d\n", i);
+      return 1;
+    }
+  n = fread(data, sizeof(PackedPos), n, f);
+  fclose(f);
+
+  ntrain = nvalid = 0;
+  for (int i = 0; i < n; i++) {
+    if (i % VALIDATION == 0)
+      valid[nvalid++] = i;
+    else
+      train[ntrain++] = i;
+  }
+  printf("%d positions for training, %d for validation\n", ntrain, nvalid);
+  if (!ntrain)
+    return 1;
+  batch = ntrain < BATCH ? ntrain : BATCH;
+
+  init_net();
+  for (int e = 1; e <= epochs; e++) {
+    start = get_time();
+
+    for (int i = ntrain - 1; i > 0; i--) {
+      int j = rand_uint64() % (i + 1);
+      tmp = train[i], train[i] = train[j], train[j] = tmp;
+    }
+
+    loss = 0;
+    for (int b = 0; b + batch <= ntrain; b += batch) {
+      loss += run(jobs, threads, train + b, batch, 1);
+      update(jobs, threads, batch, lr, ++t);
+    }
+
+    printf("epoch %d train %.6f valid %.6f lr %.6f time %dms\n", e,
+           loss / (ntrain - ntrain % batch),
+           nvalid ? run(jobs, threads, valid, nvalid, 0) / nvalid : 0.0, lr,
+           get_time() - start);
+    fflush(stdout);
+    lr *= LR_DECAY;
+  }
+
+  if (export(argv[2])) {
+    printf("cannot write %s\n", argv[2]);
+    return 1;
+  }
+  printf("network written to %s\n", argv[2]);
+  return 0;
+}
@@ -4,32 +4,76 @@
 #include "chesslib.h"
 #include "tt.h"
 
+/*
+ * data of an entry:
+ * 000000|00000000000000|00|00000000|000000000000000000|0000000000000000
+ *  age  |     eval     |bd|  depth |       value      |      move
+ * Age is the search which stored the entry, modulo 64.
+ * Key is stored xored with data, so that an entry torn by concurrent writes
+ * of different threads is never mistaken for a hit.
+ * A key may be stored in any entry of its bucket of BUCKET entries, which
+ * share a cache line. New positions replace the entry worth least, the
+ * shallowest one once each search it is older counts as AGE_WEIGHT plies.
+ */
 typedef struct {
-  Key  key;
-  Move best;
+  Key      key;
+  uint64_t data;
 } Entry;
 
 struct TT {
   Entry *entries;
-  int    num; /* number of entries */
+  int    num;  /* number of entries */
+  int    size; /* bytes asked for */
+  int    age;  /* of current search */
 };
 
+#define DATA_MOVE(d)  ((Move)((d) & 0xFFFF))
+#define DATA_VALUE(d) ((int)(((d) >> 16) & 0x3FFFF) - 0x20000)
+#define DATA_DEPTH(d) ((int)(int8_t)(((d) >> 34) & 0xFF))
+#define DATA_BOUND(d) ((Bound)(((d) >> 42) & 3))
+#define DATA_EVAL(d)  ((int)(((d) >> 44) & 0x3FFF) - 0x2000)
+#define DATA_AGE(d)   ((int)((d) >> 58))
+
+#define EVAL_NONE  -0x2000 /* VALUE_NONE does not fit into 14 bits */
+#define BUCKET     4
+#define AGE_WEIGHT 8
+
+int tt_size = 2;
+
+static inline uint64_t
+pack(Move m, int value, int eval, int depth, Bound bound, int age)
+{
+  eval = eval == VALUE_NONE ? EVAL_NONE
+       : eval < -0x1FFF ? -0x1FFF : eval > 0x1FFF ? 0x1FFF : eval;
+  return (uint64_t)(m & 0xFFFF)
+       | (uint64_t)(value + 0x20000) << 16
+       | (uint64_t)(uint8_t)depth    << 34
+       | (uint64_t)bound             << 42
+       | (uint64_t)(eval + 0x2000)   << 44
+       | (uint64_t)age               << 58;
+}
+
 TT *
 tt_new(int size)
 {
   TT *tt;
+  void *entries;
   if (!(tt = malloc(sizeof(TT))))
     return NULL;
 
-  size /= sizeof(TT);
-  tt->num = 1;
+  tt->size = size;
+  size /= sizeof(Entry);
+  tt->num = BUCKET;
   while (tt->num < size)
     tt->num <<= 1;
 
-  if (!(tt->entries = malloc(sizeof(Entry) * tt->num))) {
+  /* buckets are aligned to cache lines, memory of posix_memalign is freed
+     by free */
+  if (posix_memalign(&entries, BUCKET * sizeof(Entry), sizeof(Entry) * tt->num)) {
     free(tt);
     return NULL;
   }
+  tt->entries = entries;
   
   tt_clear(tt);
   return tt;
@@ -50,22 +94,86 @@ tt_clear(TT *tt)
   Entry *et;
   for (et = tt->entries; et < tt->entries + tt->num; et++) {
     et->key  = 0ULL;
-    et->best = MOVE_NONE;
+    et->data = 0ULL;
   }
+  tt->age = 0;
+}
+
+int
+tt_bytes(const TT *tt)
+{
+  return tt->size;
+}
+
+void
+tt_new_search(TT *tt)
+{
+  tt->age = (tt->age + 1) & 63;
+}
+
+static inline Entry *
+bucket_of(TT *tt, const Key key)
+{
+  return &tt->entries[key & (tt->num - BUCKET)];
+}
+
+/* Returns how much entry of data is worth keeping. */
+static inline int
+worth(const TT *tt, uint64_t data)
+{
+  return DATA_DEPTH(data) - AGE_WEIGHT * ((tt->age - DATA_AGE(data)) & 63);
 }
 
 void
-tt_store(TT *tt, const Key key, const Move m)
+tt_store(TT *tt, const Key key, const Move m, int value, int eval,
+         int depth, Bound bound)
 {
-  int index = key & (tt->num - 1);
-  tt->entries[index] = (Entry){ .key = key, .best = m };
+  Entry *bucket = bucket_of(tt, key), *et = bucket;
+  uint64_t data;
+  int same = 0;
+
+  for (int i = 0; i < BUCKET; i++)
+    if ((bucket[i].key ^ bucket[i].data) == key) {
+      et   = bucket + i;
+      same = 1;
+      break;
+    } else if (worth(tt, bucket[i].data) < worth(tt, et->data)) {
+      et = bucket + i;
+    }
+  data = et->data;
+
+  /* keep deeper entries of the same position stored by this search unless
+     new one is exact */
+  if (same && DATA_AGE(data) == tt->age && bound != BOUND_EXACT
+  &&  depth < DATA_DEPTH(data) - 3)
+    return;
+
+  /* keep old move if we have no better one */
+  if (m == MOVE_NONE && same)
+    data = pack(DATA_MOVE(data), value, eval, depth, bound, tt->age);
+  else
+    data = pack(m, value, eval, depth, bound, tt->age);
+
+  et->key  = key ^ data;
+  et->data = data;
 }
 
-Move
-tt_probe(TT *tt, const Key key)
+int
+tt_probe(TT *tt, const Key key, TTEntry *te)
 {
-  int index = key & (tt->num - 1);
-  if (key == tt->entries[index].key)
-    return tt->entries[index].best;
-  return MOVE_NONE;
+  Entry *bucket = bucket_of(tt, key);
+  uint64_t data;
+  int i;
+
+  for (i = 0; i < BUCKET; i++)
+    if ((bucket[i].key ^ (data = bucket[i].data)) == key)
+      break;
+  if (i == BUCKET)
+    return 0;
+  te->move  = DATA_MOVE(data);
+  te->value = DATA_VALUE(data);
+  te->depth = DATA_DEPTH(data);
+  te->bound = DATA_BOUND(data);
+  te->eval  = DATA_EVAL(data) == EVAL_NONE ? VALUE_NONE : DATA_EVAL(data);
+  return 1;
 }
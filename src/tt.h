@@ -10,11 +10,37 @@ typedef uint64_t Key;
 
 typedef struct TT TT;
 
+typedef enum {
+  BOUND_NONE,
+  BOUND_UPPER,
+  BOUND_LOWER,
+  BOUND_EXACT = BOUND_UPPER | BOUND_LOWER,
+} Bound;
+
+/* Unpacked content of a transposition table entry. */
+typedef struct {
+  Move  move;
+  int   value;
+  int   eval;  /* static evaluation, VALUE_NONE if not known */
+  int   depth;
+  Bound bound;
+} TTEntry;
+
+/* Size of tables created by set_position in MB. */
+extern int tt_size;
+
 TT *tt_new(int size);
 void tt_delete(TT *tt);
 void tt_clear(TT *tt);
+/* Returns size in bytes the table was created with. */
+int tt_bytes(const TT *tt);
+/* Starts a new search, entries of earlier searches are still found but they
+   no longer keep their place. */
+void tt_new_search(TT *tt);
 
-void tt_store(TT *tt, const Key key, const Move m);
-Move tt_probe(TT *tt, const Key key);
+void tt_store(TT *tt, const Key key, const Move m, int value, int eval,
+              int depth, Bound bound);
+/* Returns 1 and fills te if key is in the table, 0 otherwise. */
+int tt_probe(TT *tt, const Key key, TTEntry *te);
 
 #endif /* __TT_H__ */
@@ -0,0 +1,380 @@
+/* See LICENSE file for file for copyright and license details */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#undef INFINITY /* chesslib.h has its own */
+
+#include "bitboards.h"
+#include "chesslib.h"
+#include "datagen.h"
+#include "evaluate.h"
+#include "misc.h"
+#include "position.h"
+#include "tt.h"
+
+#define MAX_THREADS 64
+#define LR          1.0 /* Adam step in centipawns */
+#define REPORT      50  /* epochs between reports */
+
+/* Field of EvalParams, rows 0 is scalar, rows 1 is one dimensional array. */
+typedef struct {
+  const char *name;
+  int         rows;
+  int         cols;
+} Field;
+
+/* Must follow EvalParams in evaluate.h. */
+static const Field fields[] = {
+  { "pawn_pcsq",       64,  2 },
+  { "passed",           8,  2 },
+  { "isolated",         1,  2 },
+  { "doubled",          1,  2 },
+  { "knight_pcsq",     64,  2 },
+  { "knight_mobility",  0,  1 },
+  { "bishop_pcsq",     64,  2 },
+  { "bishop_mobility",  0,  1 },
+  { "outpost",          1,  2 },
+  { "bishop_pair",      1,  2 },
+  { "rook_pcsq",        1, 64 },
+  { "open_file",        1,  2 },
+  { "king_file",        0,  1 },
+  { "king_pcsq",       64,  2 },
+  { "king_shield",      1,  2 },
+};
+
+/* Position reduced to terms of its evaluation for white, which is material
+   plus dot product of coefficients and parameters. Coefficients are padded
+   with zeros to multiple of 8. */
+typedef struct {
+  long  offset; /* first coefficient in pool */
+  int   n;
+  float material;
+  float result; /* 0, 0.5 or 1 for white */
+} Entry;
+
+/* Work of one thread on a range of entries. */
+typedef struct {
+  pthread_t handle;
+  int       lo, hi;
+  int       grad; /* accumulate gradient, otherwise only error */
+  double    error;
+  double    g[NUM_PARAMS];
+} Job;
+
+static Entry   *entries;
+static int      nentries;
+static int32_t *cidx; /* parameter of coefficient */
+static float   *cval;
+static long     ncoeffs, maxcoeffs;
+static float    params[NUM_PARAMS];
+static double   K;
+
+/* Sparse dot product, padding lets the compiler unroll it by 8. Explicit
+   avx2 gathers were slower than this at ~18 coefficients per position. */
+static inline float
+dot(const int32_t *idx, const float *val, int n)
+{
+  float s = 0;
+  for (int i = 0; i < n; i += 8)
+    for (int k = i; k < i + 8; k++)
+      s += params[idx[k]] * val[k];
+  return s;
+}
+
+static inline double
+sigmoid(double x)
+{
+  return 1 / (1 + exp(-x));
+}
+
+static void *
+run_job(void *arg)
+{
+  Job *j = arg;
+  const Entry *e;
+  double s, d;
+
+  j->error = 0;
+  if (j->grad)
+    memset(j->g, 0, sizeof(j->g));
+  for (int i = j->lo; i < j->hi; i++) {
+    e = entries + i;
+    s = sigmoid(K * (e->material + dot(cidx + e->offset, cval + e->offset, e->n)));
+    j->error += (s - e->result) * (s - e->result);
+    if (!j->grad)
+      continue;
+    d = 2 * (s - e->result) * s * (1 - s) * K;
+    for (int k = 0; k < e->n; k++)
+      j->g[cidx[e->offset + k]] += d * cval[e->offset + k];
+  }
+  return NULL;
+}
+
+/* Returns mean squared error over all entries, sums gradient into jobs[0]. */
+static double
+run(Job *jobs, int threads, int grad)
+{
+  double error = 0;
+
+  for (int t = 0; t < threads; t++) {
+    jobs[t].lo   = (long)nentries * t / threads;
+    jobs[t].hi   = (long)nentries * (t + 1) / threads;
+    jobs[t].grad = grad;
+    pthread_create(&jobs[t].handle, NULL, run_job, jobs + t);
+  }
+  for (int t = 0; t < threads; t++) {
+    pthread_join(jobs[t].handle, NULL);
+    error += jobs[t].error;
+    for (int k = 0; grad && t && k < NUM_PARAMS; k++)
+      jobs[0].g[k] += jobs[t].g[k];
+  }
+  return error / nentries;
+}
+
+/* Finds K minimising error of current parameters by golden section search,
+   error is unimodal in K. */
+static void
+fit_k(Job *jobs, int threads)
+{
+  const double r = (sqrt(5) - 1) / 2;
+  double a = 0, b = 0.02, c, d, ec, ed;
+
+  c = b - r * (b - a), d = a + r * (b - a);
+  K = c, ec = run(jobs, threads, 0);
+  K = d, ed = run(jobs, threads, 0);
+  for (int i = 0; i < 40; i++) {
+    if (ec < ed) {
+      b = d, d = c, ed = ec;
+      c = b - r * (b - a);
+      K = c, ec = run(jobs, threads, 0);
+    } else {
+      a = c, c = d, ec = ed;
+      d = a + r * (b - a);
+      K = d, ed = run(jobs, threads, 0);
+    }
+  }
+  K = (a + b) / 2;
+}
+
+/* Adds position with result for white to entries. */
+static int
+add_entry(const Position *pos, float result)
+{
+  static int trace[NUM_PARAMS];
+  Entry *e;
+  int value = evaluate_trace(pos, trace);
+
+  if (nentries % 65536 == 0
+  &&  !(entries = realloc(entries, sizeof(Entry) * (nentries + 65536))))
+    return -1;
+  if (ncoeffs + NUM_PARAMS + 8 > maxcoeffs) {
+    maxcoeffs = 2 * maxcoeffs + NUM_PARAMS + 8;
+    if (!(cidx = realloc(cidx, sizeof(int32_t) * maxcoeffs))
+    ||  !(cval = realloc(cval, sizeof(float) * maxcoeffs)))
+      return -1;
+  }
+
+  e = entries + nentries++;
+  e->offset   = ncoeffs;
+  e->material = value;
+  e->result   = result;
+  for (int k = 0; k < NUM_PARAMS; k++) {
+    if (!trace[k])
+      continue;
+    cidx[ncoeffs] = k;
+    cval[ncoeffs] = trace[k];
+    ncoeffs++;
+    e->material -= trace[k] * params[k];
+  }
+  for (; (ncoeffs - e->offset) % 8; ncoeffs++)
+    cidx[ncoeffs] = 0, cval[ncoeffs] = 0;
+  e->n = ncoeffs - e->offset;
+  return 0;
+}
+
+/* Reads positions of datagen, or lines of fen with result as 1-0, 0-1,
+   1/2-1/2 or [1.0], [0.5], [0.0] from file ending with .epd. */
+static int
+load(const char *file, Position *pos)
+{
+  size_t len = strlen(file);
+  char line[512], fen[128], *s;
+  PackedPos pp;
+  float result;
+  FILE *f;
+
+  if (!(f = fopen(file, "rb")))
+    return -1;
+
+  if (len > 4 && !strcmp(file + len - 4, ".epd")) {
+    while (fgets(line, sizeof(line), f)) {
+      if (strstr(line, "1/2-1/2"))
+        result = 0.5;
+      else if (strstr(line, "1-0"))
+        result = 1;
+      else if (strstr(line, "0-1"))
+        result = 0;
+      else if ((s = strchr(line, '[')))
+        result = atof(s + 1);
+      else
+        continue;
+      set_position(pos, line);
+      if (add_entry(pos, result))
+        return -1;
+    }
+  } else {
+    while (fread(&pp, sizeof(pp), 1, f) == 1) {
+      U64 mask = pp.occupancy;
+      int i = 0, empty = 0, p;
+
+      s = fen;
+      for (Square sq = SQ_A8; sq <= SQ_H1; sq++) {
+        if (mask & get_bitboard(sq)) {
+          if (empty)
+            *s++ = '0' + empty, empty = 0;
+          p = (pp.pieces[i / 2] >> 4 * (i & 1)) & 15;
+          *s++ = "PNBRQK"[p & 7] | (p >> 3) * 32; /* black is lower case */
+          i++;
+        } else {
+          empty++;
+        }
+        if (sq % 8 == 7) {
+          if (empty)
+            *s++ = '0' + empty, empty = 0;
+          if (sq != SQ_H1)
+            *s++ = '/';
+        }
+      }
+      sprintf(s, " %c - - 0 1", pp.turn == WHITE ? 'w' : 'b');
+      set_position(pos, fen);
+      if (add_entry(pos, pp.result / 2.0))
+        return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+static int
+write_header(const char *file, const int *v)
+{
+  const Field *fd;
+  FILE *f;
+
+  if (!(f = fopen(file, "w")))
+    return -1;
+  fprintf(f, "/* Evaluation parameters, generated by tuner. */\n");
+  fprintf(f, "const EvalParams eval_params = {\n");
+  for (fd = fields; fd < fields + sizeof(fields) / sizeof(*fields); fd++) {
+    fprintf(f, "  .%s = ", fd->name);
+    if (!fd->rows) {
+      fprintf(f, "%d,\n", *v++);
+    } else if (fd->rows == 1 && fd->cols <= 8) {
+      fprintf(f, "{");
+      for (int c = 0; c < fd->cols; c++)
+        fprintf(f, " %d%s", *v++, c + 1 < fd->cols ? "," : " },\n");
+    } else if (fd->rows == 1) {
+      fprintf(f, "{\n");
+      for (int c = 0; c < fd->cols; c++)
+        fprintf(f, "%s%4d,%s", c % 8 ? "" : "   ", *v++, c % 8 == 7 ? "\n" : "");
+      fprintf(f, "  },\n");
+    } else {
+      fprintf(f, "{\n");
+      for (int r = 0; r < fd->rows; r++, v += 2)
+        fprintf(f, "%s{%4d,%4d},%s", r % 8 ? " " : "    ", v[0], v[1],
+                r % 8 == 7 || r + 1 == fd->rows ? "\n" : "");
+      fprintf(f, "  },\n");
+    }
+  }
+  fprintf(f, "};\n");
+  return fclose(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static Position pos;
+  static Job jobs[MAX_THREADS];
+  static double m[NUM_PARAMS], v[NUM_PARAMS];
+  int epochs, threads, n = 0, rounded[NUM_PARAMS], positional, max = 0;
+  const char *out;
+  double error;
+  int start = get_time();
+
+  if (argc < 2) {
+    printf("usage: %s data [epochs] [threads] [out]\n", argv[0]);
+    return 1;
+  }
+  epochs  = argc > 2 ? atoi(argv[2]) : 1000;
+  threads = argc > 3 ? atoi(argv[3]) : 1;
+  threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+  out     = argc > 4 ? argv[4] : "evalparams.h";
+
+  for (const Field *fd = fields; fd < fields + sizeof(fields) / sizeof(*fields); fd++)
+    n += (fd->rows ? fd->rows : 1) * fd->cols;
+  if (n != NUM_PARAMS) {
+    printf("fields describe %d parameters, EvalParams has %d\n", n, NUM_PARAMS);
+    return 1;
+  }
+
+  initialise_bitboards();
+  initialise_zobrist_keys();
+  initialise_evaluation();
+  tt_size = 0; /* positions are only evaluated */
+
+  for (int k = 0; k < NUM_PARAMS; k++)
+    params[k] = ((const int *)&eval_params)[k];
+  if (load(argv[1], &pos) || !nentries) {
+    printf("cannot load positions from %s\n", argv[1]);
+    return 1;
+  }
+  printf("%d positions, %.1f coefficients each, loaded in %dms\n", nentries,
+         (double)ncoeffs / nentries, get_time() - start);
+
+  fit_k(jobs, threads);
+  printf("K %.6f error %.6f\n", K, run(jobs, threads, 0));
+  fflush(stdout);
+
+  for (int e = 1; e <= epochs; e++) {
+    error = run(jobs, threads, 1);
+    for (int k = 0; k < NUM_PARAMS; k++) {
+      double g = jobs[0].g[k] / nentries;
+      m[k] = 0.9   * m[k] + 0.1   * g;
+      v[k] = 0.999 * v[k] + 0.001 * g * g;
+      params[k] -= LR * (m[k] / (1 - pow(0.9, e)))
+                 / (sqrt(v[k] / (1 - pow(0.999, e))) + 1e-8);
+    }
+    if (e % REPORT == 0 || e == epochs) {
+      printf("epoch %d error %.6f time %dms\n", e, error, get_time() - start);
+      fflush(stdout);
+    }
+  }
+
+  for (int k = 0; k < NUM_PARAMS; k++)
+    params[k] = rounded[k] = lround(params[k]);
+  printf("rounded error %.6f\n", run(jobs, threads, 0));
+
+  /* lazy evaluation relies on positional terms staying below margin */
+  for (int i = 0; i < nentries; i++) {
+    positional = abs((int)lround(dot(cidx + entries[i].offset,
+                                     cval + entries[i].offset, entries[i].n)));
+    max = positional > max ? positional : max;
+  }
+  if (max > LAZY_MARGIN) {
+    printf("positional terms reach %d, above LAZY_MARGIN %d, %s not written\n",
+           max, LAZY_MARGIN, out);
+    return 1;
+  }
+
+  if (write_header(out, rounded)) {
+    printf("cannot write %s\n", out);
+    return 1;
+  }
+  printf("parameters written to %s\n", out);
+
+  tt_delete(pos.tt);
+  delete_bitboards();
+  return 0;
+}
@@ -1,15 +1,23 @@
 /* See LICENSE file for file for copyright and license details */
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "book.h"
 #include "chesslib.h"
+#include "egtb.h"
 #include "misc.h"
 #include "movegen.h"
+#include "nnue.h"
 #include "position.h"
 #include "search.h"
+#include "tbprobe.h"
+#include "timeman.h"
+#include "trace.h"
 #include "uci.h"
 
+#define LEN(a) (sizeof(a) / sizeof(*(a)))
 #define startpos "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
 
 static Move parse_move(Position *pos, char *move_string);
@@ -18,6 +26,141 @@ static inline void isready(void);
 static inline void uci(void);
 static void go(Position *pos, char *input);
 static void position(Position *pos, char *input);
+static void setoption(Position *pos, char *input);
+static void push_command(char *cmd);
+static char *pop_command(void);
+static void *read_commands(void *arg);
+
+#define QUEUE_SIZE 64
+#define INPUT_SIZE 0x20000 /* moves of longest game the 75 move rule allows */
+
+/* Position command up to last move played, so that next one can continue. */
+static char last_position[INPUT_SIZE];
+
+/* Commands read from stdin, waiting to be executed. */
+static struct {
+  char           *cmd[QUEUE_SIZE];
+  int             head;
+  int             cnt;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+} queue = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond  = PTHREAD_COND_INITIALIZER,
+};
+
+/* Book moves are played up to move book_depth of the game, the best one or
+   a random one in proportion to weights. */
+static int own_book   = 0;
+static int book_depth = 20;
+static int book_best  = 0;
+
+/* Options of type spin, that can be set with setoption command. */
+typedef struct {
+  const char *name;
+  int        *value;
+  int         min;
+  int         max;
+} Option;
+
+static const Option options[] = {
+  { "Threads",             &info.threads,            1, MAX_THREADS },
+  { "MultiPV",             &info.multipv,            1, MAX_MULTIPV },
+  { "Hash",                &tt_size,                 1, 1024        },
+  { "RFPMargin",           &params.rfp_margin,       0, 1000        },
+  { "RazorMargin",         &params.razor_margin,     0, 1000        },
+  { "FutilityMargin",      &params.futility_margin,  0, 1000        },
+  { "LMPBase",             &params.lmp_base,         0, 64          },
+  { "NullMoveVerifyDepth", &params.nmp_verify_depth, 1, MAX_PLY     },
+  { "IIDDepth",            &params.iid_depth,        0, MAX_PLY     },
+  { "IIDMode",             &params.iid_mode,         0, 1           },
+  { "DeltaMargin",         &params.delta_margin,     0, 1000        },
+  { "SyzygyProbeDepth",    &tb_probe_depth,          1, 100         },
+  { "OwnBook",             &own_book,                0, 1           },
+  { "BookDepth",           &book_depth,              1, 512         },
+  { "BookBestMove",        &book_best,               0, 1           },
+#ifdef TRACE
+  { "TraceMaxPly",         &trace_max_ply,           0, MAX_PLY     },
+  { "TraceMaxNodes",       &trace_max_nodes,         1, 50000000    },
+#endif
+};
+
+#define OPTION_LEN 256
+
+/* Options of type string, apply is called after the value is set. */
+typedef struct {
+  const char *name;
+  char       *value;
+  void      (*apply)(Position *pos);
+} StringOption;
+
+#ifdef NNUE
+static char eval_file[OPTION_LEN] = NNUE_FILE;
+static void load_eval_file(Position *pos);
+#endif
+static char syzygy_path[OPTION_LEN] = "<empty>";
+static void load_syzygy_path(Position *pos);
+static char egtb_path[OPTION_LEN] = "<empty>";
+static void load_egtb_path(Position *pos);
+static char book_file[OPTION_LEN] = "<empty>";
+static void load_book_file(Position *pos);
+
+static const StringOption string_options[] = {
+#ifdef NNUE
+  { "EvalFile",   eval_file,   load_eval_file   },
+#endif
+  { "SyzygyPath", syzygy_path, load_syzygy_path },
+  { "EGTBPath",   egtb_path,   load_egtb_path   },
+  { "BookFile",   book_file,   load_book_file   },
+  { NULL,         NULL,        NULL             },
+};
+
+#ifdef NNUE
+static void
+load_eval_file(Position *pos)
+{
+  if (nnue_load(eval_file)) {
+    printf("info string cannot load network %s, using classical evaluation\n",
+           eval_file);
+    nnue_unload();
+  } else {
+    printf("info string using network %s\n", eval_file);
+  }
+  refresh_accumulator(pos);
+  search_clear(pos); /* cached evaluations are of previous network */
+}
+#endif
+
+static void
+load_syzygy_path(Position *pos)
+{
+  int n = tb_init(syzygy_path);
+  (void)pos;
+  if (n)
+    printf("info string found %d tablebases, largest has %d pieces\n",
+           n, tb_largest);
+}
+
+static void
+load_egtb_path(Position *pos)
+{
+  int n = egtb_init(egtb_path);
+  (void)pos;
+  if (n)
+    printf("info string found %d endgame tables, largest has %d pieces\n",
+           n, egtb_largest);
+}
+
+static void
+load_book_file(Position *pos)
+{
+  int n = book_init(book_file);
+  (void)pos;
+  if (n)
+    printf("info string book %s has %d entries\n", book_file, n);
+  else if (strcmp(book_file, "<empty>"))
+    printf("info string cannot load book %s\n", book_file);
+}
 
 static Move
 parse_move(Position *pos, char *move_string)
@@ -56,17 +199,36 @@ uci(void)
 {
   printf("id name Botstasiu alpha\n");
   printf("id author Stanisław Bitner\n");
+  for (const Option *o = options; o < options + LEN(options); o++)
+    printf("option name %s type spin default %d min %d max %d\n",
+           o->name, *o->value, o->min, o->max);
+  for (const StringOption *o = string_options; o->name; o++)
+    printf("option name %s type string default %s\n", o->name, o->value);
   printf("uciok\n");
 }
 
 static void
 go(Position *pos, char *input)
 {
-  int depth = -1, movestogo = 30, movetime = -1;
+  int depth = -1, movestogo = 0, movetime = -1;
   int time = -1, inc = 0;
   char *token = NULL;
+  Move m;
+
+  /* book move is played at once, unless search is asked for analysis */
+  if (own_book && pos->game_ply < 2 * book_depth
+  &&  !strstr(input, "infinite") && !strstr(input, "mate")
+  &&  (m = book_probe(pos, book_best)) != MOVE_NONE) {
+    info.best_move  = m;
+    info.best_value = 0;
+    printf("bestmove ");
+    print_move(m);
+    printf("\n");
+    return;
+  }
 
-  info.timeset = 0;
+  info.mate = 0;
+  info.nodes_limit = 0;
 
   if ((token = strstr(input, "infinite")))
     depth = MAX_PLY;
@@ -84,55 +246,142 @@ go(Position *pos, char *input)
     movetime = atoi(token + 9);
   if ((token = strstr(input, "depth")))
     depth = atoi(token + 6);
+  if ((token = strstr(input, "nodes")))
+    info.nodes_limit = strtoull(token + 6, NULL, 10);
+  if ((token = strstr(input, "mate")))
+    info.mate = atoi(token + 5);
 
   info.starttime = get_time();
 
   info.depth = depth == -1 ? MAX_PLY : depth;
 
-  if (movetime != -1) {
-    time = movetime;
-    movestogo = 1;
-  }
-
-  if (time != -1) {
-    info.timeset = 1;
-    time /= movestogo;
-    if (time > 1500) time -= 50;
-    info.stoptime = info.starttime + time + inc;
-  }
+  time_init(time, inc, movestogo, movetime);
 
-  search(pos);
+  search_start(pos);
 }
 
 static void
 position(Position *pos, char *input)
 {
-  char *token;
-  input += 9; /* skip "position " */
+  size_t end = strcspn(input, "\r\n"), len = strlen(last_position);
+  char *token, *played;
+  Move m;
 
-  if (!strncmp(input, "startpos", 8)) {
-    set_position(pos, startpos);
-    input += 8;
+  /* a command extending the previous one by some moves only plays them */
+  if (len && len <= end && !strncmp(input, last_position, len)
+  &&  (len == end || input[len] == ' ')
+  &&  (strstr(last_position, "moves") || !strncmp(input + len, " moves", 6))) {
+    token = input + len;
+    if (!strncmp(token, " moves", 6))
+      token += 6;
   } else {
-    token = strstr(input, "fen");
-    if (token == NULL)
+    if (!strncmp(input + 9, "startpos", 8)) /* skip "position " */
       set_position(pos, startpos);
-    else {
-      token += 4; /* skip "fen " */
-      set_position(pos, token);
-    }
+    else if ((token = strstr(input, "fen")))
+      set_position(pos, token + 4); /* skip "fen " */
+    else
+      set_position(pos, startpos);
+    token = (token = strstr(input, "moves")) ? token + 5 : input + end;
   }
-  token = strstr(input, "moves");
-  if (token != NULL) {
-    token += 6; /* skip "moves " */
-    Move m;
-    while (*token) {
-      if ((m = parse_move(pos, token)) == MOVE_NONE)
-        break;
-      do_move(pos, m);
-      while (*token && *token++ != ' ');
+
+  for (played = token; ; played = token) {
+    while (*token == ' ')
+      token++;
+    if (token >= input + end || (m = parse_move(pos, token)) == MOVE_NONE)
+      break;
+    /* search needs free states after the last move, set_root frees them
+       unless no capture or pawn move was played for that long */
+    if (pos->game_ply >= MAX_GAME_PLY - MAX_SEARCH_PLY) {
+      printf("info string moves from %.*s are not played, game is too long\n",
+             (int)strcspn(token, " \r\n"), token);
+      break;
     }
+    do_move(pos, m);
+    set_root(pos);
+    token += strcspn(token, " \r\n");
   }
+  snprintf(last_position, sizeof(last_position), "%.*s",
+           (int)(played - input), input);
+}
+
+static void
+setoption(Position *pos, char *input)
+{
+  char *name, *value;
+  int v;
+
+  if (!(name = strstr(input, "name ")) || !(value = strstr(input, " value ")))
+    return;
+  name += 5;
+  v = atoi(value + 7);
+  last_position[0] = '\0'; /* new hash size is applied by set_position */
+
+  for (const StringOption *o = string_options; o->name; o++) {
+    if (strncmp(name, o->name, strlen(o->name)))
+      continue;
+    value += 7;
+    value[strcspn(value, "\r\n")] = '\0';
+    snprintf(o->value, OPTION_LEN, "%s", value);
+    if (o->apply)
+      o->apply(pos);
+    return;
+  }
+
+  for (const Option *o = options; o < options + LEN(options); o++) {
+    if (strncmp(name, o->name, strlen(o->name)))
+      continue;
+    *o->value = v < o->min ? o->min : v > o->max ? o->max : v;
+    return;
+  }
+  printf("Unknown option: %s", name);
+}
+
+static void
+push_command(char *cmd)
+{
+  pthread_mutex_lock(&queue.mutex);
+  while (queue.cnt == QUEUE_SIZE)
+    pthread_cond_wait(&queue.cond, &queue.mutex);
+  queue.cmd[(queue.head + queue.cnt++) % QUEUE_SIZE] = cmd;
+  pthread_cond_broadcast(&queue.cond);
+  pthread_mutex_unlock(&queue.mutex);
+}
+
+static char *
+pop_command(void)
+{
+  char *cmd;
+  pthread_mutex_lock(&queue.mutex);
+  while (!queue.cnt)
+    pthread_cond_wait(&queue.cond, &queue.mutex);
+  cmd = queue.cmd[queue.head];
+  queue.head = (queue.head + 1) % QUEUE_SIZE;
+  queue.cnt--;
+  pthread_cond_broadcast(&queue.cond);
+  pthread_mutex_unlock(&queue.mutex);
+  return cmd;
+}
+
+/* Reads commands from stdin and queues them for uci_loop. Stop and quit also
+   take effect immediately, even if uci_loop waits for search to end. */
+static void *
+read_commands(void *arg)
+{
+  char input[INPUT_SIZE];
+  (void)arg;
+
+  while (fgets(input, sizeof(input), stdin)) {
+    if (input[0] == '\n')
+      continue;
+    if (!strncmp(input, "stop", 4) || !strncmp(input, "q", 1))
+      search_stop();
+    push_command(strdup(input));
+    if (!strncmp(input, "q", 1))
+      return NULL;
+  }
+  search_stop();
+  push_command(strdup("quit\n"));
+  return NULL;
 }
 
 void
@@ -143,42 +392,60 @@ uci_loop(void)
 
   setbuf(stdin,  NULL);
   setbuf(stdout, NULL);
-  char input[6969];
+  char *input;
+  pthread_t reader;
 
   info.quit = 0;
+  info.threads = 1;
+  info.multipv = 1;
+#ifdef NNUE
+  load_eval_file(&pos);
+#endif
+
+  pthread_create(&reader, NULL, read_commands, NULL);
 
   while (!info.quit) {
-    memset(input, 0, sizeof(input));
     fflush(stdout);
 
-    if (!fgets(input, 6969, stdin) ||  input[0] == '\n')
-      continue;
+    input = pop_command();
 
+    /* search runs in background, so commands which change its input have
+       to wait for it to finish */
     if (!strncmp(input, "isready", 7))
       isready();
     else if (!strncmp(input, "ucinewgame", 10))
-      position(&pos, "position startpos");
+      search_wait(), search_clear(&pos), position(&pos, "position startpos");
     else if (!strncmp(input, "uci", 3))
       uci();
     else if (!strncmp(input, "position", 8))
-      position(&pos, input);
+      search_wait(), position(&pos, input);
+    else if (!strncmp(input, "setoption", 9))
+      search_wait(), setoption(&pos, input);
     else if (!strncmp(input, "go", 2))
-      go(&pos, input);
+      search_wait(), go(&pos, input);
     else if (!strncmp(input, "d", 1))
-      print_position(&pos);
+      search_wait(), print_position(&pos);
     else if (!strncmp(input, "stop", 4))
-      info.stopped = 1;
+      search_stop();
     else if (!strncmp(input, "quit", 4)
          ||  !strncmp(input, "q", 1))
       info.quit = 1;
     else
       printf("Unknown command: %s", input);
-  }
 
-  while (pos.st) {
-    State *xd = pos.st->prev;
-    free(pos.st);
-    pos.st = xd;
+    free(input);
   }
+
+  search_stop();
+  search_wait();
+  pthread_join(reader, NULL);
+
+  delete_threads();
   tt_delete(pos.tt);
+  tb_free();
+  egtb_free();
+  book_free();
+#ifdef NNUE
+  nnue_unload();
+#endif
 }